@@ -3,6 +3,7 @@
 
 #include <cassert>
 #include <print>
+#include <unordered_map>
 
 
 // #define TEST_NOWIN
@@ -186,6 +187,330 @@ int main() {
     }
 
 
+    { // narrow_u32
+        // encoding boundaries
+        std::u32string edges{ 0x7F, 0x80, 0x7FF, 0x800, 0xFFFF, 0x10000, 0x10FFFF };
+        std::string s = utf8::narrow(edges);
+        ASSERT_EQ("\x7F\xC2\x80\xDF\xBF\xE0\xA0\x80\xEF\xBF\xBF\xF0\x90\x80\x80\xF4\x8F\xBF\xBF", s, "narrow_u32");
+
+        std::u32string text;
+        for (int i = 0; i < 50; i++) {
+            text += U"plain ASCII text, ελληνικό 😃 ";
+        }
+        s = utf8::narrow(text);
+        std::u32string r = utf8::runes(s);
+        ASSERT_EQ(text, r, "narrow_u32");
+        std::string s1 = utf8::narrow(text.c_str());
+        ASSERT_EQ(s, s1, "narrow_u32");
+
+        bool thrown = false;
+        try {
+            text[200] = 0x110000;
+            s = utf8::narrow(text);
+        }
+        catch (utf8::exception&) {
+            thrown = true;
+        }
+        ASSERT(thrown, "narrow_u32");
+    }
+
+
+    { // widen16
+        std::string s{ "ABC ελληνικό 😃 \xE2\x82" }; // ends with truncated '€'
+        std::u16string w = utf8::widen16(s);
+        ASSERT_EQ(u"ABC ελληνικό 😃 \xfffd", w, "widen16");
+
+        std::string s1 = utf8::narrow(u"ABC ελληνικό 😃");
+        ASSERT_EQ("ABC ελληνικό 😃", s1, "widen16");
+
+        // unpaired surrogates
+        const char16_t lone[]{ 0xD83D, u'A', 0xDE03, 0 };
+        s1 = utf8::narrow(lone);
+        ASSERT_EQ("\xEF\xBF\xBD" "A" "\xEF\xBF\xBD", s1, "widen16");
+    }
+
+
+    { // into_overloads
+        std::string s;
+        std::u16string w;
+        std::u32string r;
+        s.reserve(256);
+        w.reserve(256);
+        r.reserve(256);
+        const char* sbuf = s.data();
+        const char16_t* wbuf = w.data();
+        const char32_t* rbuf = r.data();
+
+        std::string words[]{ "alpha", "ελληνικό", "😃😎", "" };
+        for (auto& word : words) {
+            utf8::widen_into(word, w);
+            utf8::narrow_into(w, s);
+            ASSERT_EQ(word, s, "into_overloads");
+            auto res = utf8::runes_into(word, r);
+            ASSERT_EQ(utf8::runes_result::npos, res.error, "into_overloads");
+            utf8::narrow_into(r, s);
+            ASSERT_EQ(word, s, "into_overloads");
+        }
+        // invalid input is reported, not thrown
+        auto res = utf8::runes_into("ab\xC0z", r);
+        ASSERT_EQ(2, res.count, "into_overloads");
+        ASSERT_EQ(2, res.error, "into_overloads");
+        size_t n = r.size();
+        ASSERT_EQ(2, n, "into_overloads");
+        // no reallocations
+        ASSERT_EQ(sbuf, s.data(), "into_overloads");
+        ASSERT_EQ(wbuf, w.data(), "into_overloads");
+        ASSERT_EQ(rbuf, r.data(), "into_overloads");
+    }
+
+
+    { // utf16_utf32
+        std::u16string u16;
+        std::u32string u32;
+        for (int i = 0; i < 20; i++) {
+            u16 += u"plain text ελληνικό 😃 ";
+            u32 += U"plain text ελληνικό 😃 ";
+        }
+        std::u32string r = utf8::runes(u16);
+        ASSERT_EQ(u32, r, "utf16_utf32");
+        std::u16string w = utf8::widen16(u32);
+        ASSERT_EQ(u16, w, "utf16_utf32");
+
+        const char16_t lone[]{ u'A', 0xDC00, u'B', 0xD800, 0 };
+        r = utf8::runes(lone);
+        ASSERT_EQ(U"A\xfffd" "B\xfffd", r, "utf16_utf32");
+    }
+
+
+    { // latin1_cp1252
+        std::string latin1{ "Caf\xE9 cr\xE8me \xBD price: 5\x80" };
+        std::string s = utf8::from_latin1(latin1);
+        ASSERT_EQ("Café crème ½ price: 5\xC2\x80", s, "latin1_cp1252");
+        s = utf8::from_cp1252(latin1);
+        ASSERT_EQ("Café crème ½ price: 5€", s, "latin1_cp1252");
+
+        std::string back = utf8::to_cp1252(s);
+        ASSERT_EQ(latin1, back, "latin1_cp1252");
+
+        // € is not in Latin-1
+        bool thrown = false;
+        try {
+            back = utf8::to_latin1(s);
+        }
+        catch (utf8::exception& e) {
+            ASSERT_EQ(utf8::exception::unmappable, e.cause, "latin1_cp1252");
+            thrown = true;
+        }
+        ASSERT(thrown, "latin1_cp1252");
+        back = utf8::to_latin1(s, '?');
+        ASSERT_EQ("Caf\xE9 cr\xE8me \xBD price: 5?", back, "latin1_cp1252");
+        back = utf8::to_cp1252("a\xC0" "b", '\0');
+        ASSERT_EQ(std::string("a\0b", 3), back, "latin1_cp1252");
+    }
+
+
+    { // conversion_lengths
+        std::string s{ "ASCII ελληνικό € 😃" };
+        std::u16string s16 = utf8::widen16(s);
+        std::u32string s32 = utf8::runes(s);
+
+        size_t l = utf8::utf16_length_from_utf8(s);
+        ASSERT_EQ(s16.size(), l, "conversion_lengths");
+        l = utf8::utf32_length_from_utf8(s);
+        ASSERT_EQ(s32.size(), l, "conversion_lengths");
+        l = utf8::utf8_length_from_utf16(s16);
+        ASSERT_EQ(s.size(), l, "conversion_lengths");
+        l = utf8::utf32_length_from_utf16(s16);
+        ASSERT_EQ(s32.size(), l, "conversion_lengths");
+        l = utf8::utf8_length_from_utf32(s32);
+        ASSERT_EQ(s.size(), l, "conversion_lengths");
+        l = utf8::utf16_length_from_utf32(s32);
+        ASSERT_EQ(s16.size(), l, "conversion_lengths");
+        l = utf8::utf8_length_from_cp1252("5\x80 \xE9");
+        ASSERT_EQ(7, l, "conversion_lengths");
+    }
+
+
+    { // parallel
+        std::string s;
+        while (s.size() < 2000000) {
+            s += "ASCII ελληνικό € 😃 ";
+        }
+
+        utf8::validation_result res = utf8::validate_parallel(s, 4);
+        ASSERT(res, "parallel");
+        std::u32string expected = utf8::runes(s);
+        std::u32string actual = utf8::runes_parallel(s, 4);
+        ASSERT(expected == actual, "parallel");
+
+        s[1500001] = '\xC0';
+        s[1700001] = '\xFF';
+        utf8::validation_result serial = utf8::validate(s);
+        res = utf8::validate_parallel(s, 4);
+        ASSERT_EQ(serial.offset, res.offset, "parallel");
+        ASSERT_EQ(serial.error, res.error, "parallel");
+
+        bool thrown = false;
+        try {
+            actual = utf8::runes_parallel(s, 4);
+        }
+        catch (utf8::exception&) {
+            thrown = true;
+        }
+        ASSERT(thrown, "parallel");
+    }
+
+
+    { // compile_time
+        static_assert(utf8::valid_literal("ελληνικό"));
+        static_assert(!utf8::valid_literal("\xC0\xAF"));
+        static_assert(utf8::length_literal("ελληνικό 😃") == 10);
+
+        constexpr auto greek = utf8::runes_literal<"αβγ😃">();
+        static_assert(greek.size() == 4 && greek[0] == U'α' && greek[3] == U'😃');
+
+        constexpr auto repl = utf8::narrow_literal<U"\uFFFD">();
+        std::string_view repl_str(repl.data(), repl.size());
+        ASSERT_EQ(utf8::narrow(utf8::REPLACEMENT_CHARACTER), repl_str, "compile_time");
+
+        constexpr char32_t first = [] {
+            const char* p = "€uro";
+            return utf8::next(p, p + 6);
+        }();
+        ASSERT_EQ(U'€', first, "compile_time");
+    }
+
+
+    { // allocators
+        std::string s{ "ASCII Ελλάδα € 😃" };
+        char pool[1024];
+        std::pmr::monotonic_buffer_resource arena(pool, sizeof(pool), std::pmr::null_memory_resource());
+
+        std::pmr::u32string r = utf8::pmr::runes(s, &arena);
+        std::u32string expected32 = utf8::runes(s);
+        ASSERT(std::u32string_view(r) == expected32, "allocators");
+        std::pmr::u16string w16 = utf8::pmr::widen16(s, &arena);
+        std::u16string expected16 = utf8::widen16(s);
+        ASSERT(std::u16string_view(w16) == expected16, "allocators");
+        std::pmr::wstring w = utf8::pmr::widen(s, &arena);
+        std::wstring expectedw = utf8::widen(s);
+        ASSERT(std::wstring_view(w) == expectedw, "allocators");
+
+        std::pmr::string n = utf8::pmr::narrow(std::u32string_view(r), &arena);
+        ASSERT(std::string_view(n) == s, "allocators");
+        n = utf8::pmr::narrow(std::u16string_view(w16), &arena);
+        ASSERT(std::string_view(n) == s, "allocators");
+        n = utf8::pmr::toupper(s, &arena);
+        ASSERT_EQ("ASCII ΕΛΛΆΔΑ € 😃", n, "allocators");
+        n = utf8::pmr::tolower(s, &arena);
+        ASSERT_EQ("ascii ελλάδα € 😃", n, "allocators");
+
+        // lower case of U+023A needs more bytes
+        auto grown = utf8::tolower("\xC8\xBA", std::allocator<char>());
+        ASSERT_EQ("\xE2\xB1\xA5", grown, "allocators");
+
+        char buf[4];
+        size_t sz = utf8::narrow_into(std::u16string_view(u"€€"), std::span<char>(buf));
+        ASSERT_EQ(6, sz, "allocators");
+    }
+
+
+    { // case_tables
+        // mappings in the supplementary planes and with large differences
+        std::string s{ "𐐀 Ω ẞ Ɐ 𞤀" };
+        std::string l = utf8::tolower(s);
+        ASSERT_EQ("𐐨 ω ß ɐ 𞤢", l, "case_tables");
+        std::string u = utf8::toupper(l);
+        ASSERT_EQ("𐐀 Ω ẞ Ɐ 𞤀", u, "case_tables");
+        const char* deseret = "𐐀";
+        ASSERT(utf8::isupper(deseret), "case_tables");
+        ASSERT(!utf8::islower(deseret), "case_tables");
+    }
+
+
+    { // make_lower_in_place
+        std::string s{ "ΕΛΛΆΔΑ AND ÉCOLE" };
+        const char* data = s.data();
+        utf8::make_lower(s);
+        ASSERT_EQ("ελλάδα and école", s, "make_lower_in_place");
+        ASSERT(s.data() == data, "make_lower_in_place");
+
+        // lower case of U+023A needs one more byte
+        s = "AB\xC8\xBA cd";
+        utf8::make_lower(s);
+        ASSERT_EQ("ab\xE2\xB1\xA5 cd", s, "make_lower_in_place");
+        utf8::make_upper(s);
+        ASSERT_EQ("AB\xC8\xBA CD", s, "make_lower_in_place");
+    }
+
+
+    { // ascii_case
+        // letters next to the characters just outside the A-Z and a-z ranges
+        std::string s{ "@AZ[`az{ The Quick Brown Fox Jumps Over The Lazy Dog, ÉCOLE 0123456789" };
+        std::string l = utf8::tolower(s);
+        ASSERT_EQ("@az[`az{ the quick brown fox jumps over the lazy dog, école 0123456789", l, "ascii_case");
+        std::string u = utf8::toupper(s);
+        ASSERT_EQ("@AZ[`AZ{ THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG, ÉCOLE 0123456789", u, "ascii_case");
+        utf8::make_upper(l);
+        ASSERT_EQ(u, l, "ascii_case");
+    }
+
+
+    { // icompare_views
+        std::string_view s1{ "Straße in München, ASCII Text Long Enough For Blocks" };
+        std::string_view s2{ "STRAẞE IN MÜNCHEN, ascii text long enough for blocks" };
+        int32_t r = utf8::icompare(s1, s2);
+        ASSERT_EQ(0, r, "icompare_views");
+        r = utf8::icompare_n("abcdef", "ABCxyz", 3);
+        ASSERT_EQ(0, r, "icompare_views");
+        r = utf8::icompare_n("abcdef", "ABCxyz", 4);
+        ASSERT(r < 0, "icompare_views");
+        bool b = utf8::istarts_with(s1, "STRASSE");
+        ASSERT(!b, "icompare_views");
+        b = utf8::istarts_with(s1, "STRAẞE IN");
+        ASSERT(b, "icompare_views");
+        b = utf8::iends_with(s1, "FOR BLOCKS");
+        ASSERT(b, "icompare_views");
+        b = utf8::iends_with("ß", "xß");
+        ASSERT(!b, "icompare_views");
+    }
+
+
+    { // ihash_iequal
+        std::unordered_map<std::string, int, utf8::ihash, utf8::iequal> counts;
+        counts["Straße"]++;
+        counts["STRAẞE"]++;
+        counts["Strasse"]++;
+        size_t n = counts.size();
+        ASSERT_EQ(2, n, "ihash_iequal");
+        int c = counts["straße"];
+        ASSERT_EQ(2, c, "ihash_iequal");
+        std::string lo{ "a long ascii key that spans more than one block of the hash buffer, éèê" };
+        std::string up{ "A LONG ASCII KEY THAT SPANS MORE THAN ONE BLOCK OF THE HASH BUFFER, ÉÈÊ" };
+        size_t h1 = utf8::ihash{}(lo);
+        size_t h2 = utf8::ihash{}(up);
+        ASSERT_EQ(h1, h2, "ihash_iequal");
+        bool b = utf8::iequal{}(lo, up);
+        ASSERT(b, "ihash_iequal");
+    }
+
+
+    { // conversion_capacity
+        std::string s = utf8::narrow(std::wstring(1000, L'a'));
+        size_t n = s.size();
+        ASSERT_EQ(1000, n, "conversion_capacity");
+        ASSERT(s.capacity() < 1250, "conversion_capacity");
+        std::string cjk;
+        for (int i = 0; i < 300; i++) {
+            cjk += "日";
+        }
+        std::wstring w = utf8::widen(cjk);
+        n = w.size();
+        ASSERT_EQ(300, n, "conversion_capacity");
+        ASSERT(w.capacity() < 375, "conversion_capacity");
+    }
+
+
     { // greek_letters
         const wchar_t* greek = L"ελληνικό αλφάβητο";
         std::string s = utf8::narrow(greek);
@@ -201,6 +526,53 @@ int main() {
     }
 
 
+    { // string_len_long
+        std::string text;
+        size_t expected = 0;
+        for (int i = 0; i < 30; i++) {
+            text += "abc ελληνικό 😃 ";
+            expected += 15;
+        }
+        size_t l1 = utf8::length(text);
+        ASSERT_EQ(expected, l1, "string_len_long");
+
+        // every starting alignment of the null-terminated version
+        for (size_t off = 0; off < 16; off++) {
+            size_t l2 = utf8::length(text.c_str() + off);
+            size_t l3 = utf8::length(text.substr(off));
+            ASSERT_EQ(l3, l2, "string_len_long");
+        }
+        size_t l4 = utf8::length("");
+        ASSERT_EQ(0, l4, "string_len_long");
+    }
+
+
+    { // string_index
+        std::string text;
+        std::u32string text32;
+        for (int i = 0; i < 100; i++) {
+            text += "abc ελληνικό 😃 ";
+            text32 += U"abc ελληνικό 😃 ";
+        }
+        utf8::string_index idx(text);
+        size_t len = idx.length();
+        ASSERT_EQ(text32.size(), len, "string_index");
+
+        bool all_ok = true;
+        for (size_t n = 0; n < text32.size(); n++) {
+            all_ok = all_ok && idx.at(n) == text32[n];
+        }
+        ASSERT(all_ok, "string_index");
+
+        std::string_view sub = idx.substr(1000, 15);
+        ASSERT_EQ(utf8::narrow(text32.substr(1000, 15)), sub, "string_index");
+        sub = idx.substr(1490);
+        ASSERT_EQ(utf8::narrow(text32.substr(1490)), sub, "string_index");
+        size_t off = idx.offset(len);
+        ASSERT_EQ(text.size(), off, "string_index");
+    }
+
+
     { // wemoji
         const wchar_t* wsmiley = L"😄";
         size_t wlen = std::wcslen(wsmiley);
@@ -279,6 +651,72 @@ int main() {
     }
 
 
+    { // valid_str_long
+        // long enough to go through the vectorized validator
+        std::string text;
+        for (int i = 0; i < 20; i++) {
+            text += "abcd ελληνικό 😃😎😛 ";
+        }
+        ASSERT(utf8::valid_str(text), "valid_str_long");
+
+        std::string bad = text;
+        bad[100] = '\xC0'; // not a lead byte
+        ASSERT(!utf8::valid_str(bad), "valid_str_long");
+
+        bad = text;
+        bad.insert(64, "\xED\xA0\x80"); // surrogate at block boundary
+        ASSERT(!utf8::valid_str(bad), "valid_str_long");
+
+        bad = text;
+        bad.insert(31, "\xF4\x90\x80\x80"); // > U+10FFFF
+        ASSERT(!utf8::valid_str(bad), "valid_str_long");
+
+        bad = text + "\xF0\x9F\x98"; // truncated at end
+        ASSERT(!utf8::valid_str(bad), "valid_str_long");
+        ASSERT(utf8::valid_str("\xEF\xBF\xBD"), "valid_str_long"); // U+FFFD itself is valid
+    }
+
+
+    { // validate_errors
+        std::string text;
+        for (int i = 0; i < 400; i++) {
+            text += "abcd ελληνικό 😃😎😛 ";
+        }
+        auto res = utf8::validate(text);
+        ASSERT(res, "validate_errors");
+        ASSERT_EQ(text.size(), res.offset, "validate_errors");
+
+        struct {
+            const char* enc;
+            utf8::validation_result::error_kind kind;
+        } cases[]{
+            { "\x80", utf8::validation_result::stray_continuation },
+            { "\xC1\xBF", utf8::validation_result::overlong },
+            { "\xE0\x80\xAF", utf8::validation_result::overlong },
+            { "\xED\xA0\x80", utf8::validation_result::surrogate },
+            { "\xF4\x90\x80\x80", utf8::validation_result::too_large },
+            { "\xE2\x82 ", utf8::validation_result::truncated },
+            { "\xFF", utf8::validation_result::invalid_byte },
+        };
+        // errors placed far into the string, past the first 4k window
+        for (auto& c : cases) {
+            std::string bad = text;
+            size_t pos = 5000;
+            while ((bad[pos] & 0xC0) == 0x80) {
+                pos++;
+            }
+            bad.insert(pos, c.enc);
+            res = utf8::validate(bad);
+            ASSERT_EQ(c.kind, res.error, "validate_errors");
+            ASSERT_EQ(pos, res.offset, "validate_errors");
+        }
+
+        res = utf8::validate("abc\xF0\x9F\x98");
+        ASSERT_EQ(utf8::validation_result::truncated, res.error, "validate_errors");
+        ASSERT_EQ(3, res.offset, "validate_errors");
+    }
+
+
     { // is_valid_yes
         std::string s1 = "a";
         std::string s2 = "°";
@@ -363,6 +801,78 @@ int main() {
     }
 
 
+    { // prev_bounded
+        const char* emojis{ "😃😎😛" };
+        const char* ptr = emojis + strlen(emojis);
+        std::u32string rev;
+        while (ptr > emojis) {
+            char32_t r = utf8::prev(ptr, emojis);
+            rev.push_back(r);
+        }
+        ASSERT_EQ(U"😛😎😃", rev, "prev_bounded");
+
+        // truncated character at beginning of buffer; must not read before it
+        const char* partial{ "\x9F\x98\x83" };
+        ptr = partial + 3;
+        char32_t r = utf8::prev(ptr, partial);
+        ASSERT_EQ(utf8::REPLACEMENT_CHARACTER, r, "prev_bounded");
+        ASSERT_EQ(partial + 3, ptr, "prev_bounded");
+    }
+
+
+    { // retreat
+        std::string line;
+        for (int i = 0; i < 20; i++) {
+            line += "log entry ελληνικό 😃 ";
+        }
+        const char* first = line.c_str();
+        const char* ptr = first + line.size();
+
+        // keep the last 25 characters
+        size_t moved = utf8::retreat(ptr, first, 25);
+        ASSERT_EQ(25, moved, "retreat");
+        size_t l = utf8::length(ptr);
+        ASSERT_EQ(25, l, "retreat");
+
+        moved = utf8::retreat(ptr, first, 100000);
+        ASSERT_EQ(utf8::length(line) - 25, moved, "retreat");
+        ASSERT_EQ(first, ptr, "retreat");
+    }
+
+
+    { // codepoints
+        std::string_view str{ "A😃ελ\xC0\x80Z" };
+        utf8::codepoints cp(str);
+
+        std::u32string r;
+        for (char32_t c : cp) {
+            r.push_back(c);
+        }
+        ASSERT_EQ(U"A😃ελ\xfffdZ", r, "codepoints");
+
+        auto it = std::ranges::find(cp, U'λ');
+        ASSERT(it != cp.end(), "codepoints");
+        ASSERT_EQ(str.data() + 7, it.base(), "codepoints");
+
+        std::u32string rev;
+        for (auto p = cp.end(); p != cp.begin();) {
+            --p;
+            rev.push_back(*p);
+        }
+        ASSERT_EQ(U"Z\xfffdλε😃A", rev, "codepoints");
+
+        auto d = utf8::distance(cp.begin(), cp.end());
+        ASSERT_EQ(6, d, "codepoints");
+        it = cp.begin();
+        utf8::advance(it, 5);
+        ASSERT_EQ(U'Z', *it, "codepoints");
+        utf8::advance(it, -4);
+        ASSERT_EQ(U'😃', *it, "codepoints");
+        utf8::advance(it, 100);
+        ASSERT(it == cp.end(), "codepoints");
+    }
+
+
     { // invalid_utf8
         const char invalid[]{ "\xFE\xFF\xFF\xFE" }; // UTF-16 BOM markers
         bool thrown = false;
@@ -402,6 +912,86 @@ int main() {
     }
 
 
+    { // runes_ascii_runs
+        std::string text{ "The quick brown fox jumps over the lazy dog; ελληνικό 😃 and then more plain ASCII text" };
+        std::u32string expected{ U"The quick brown fox jumps over the lazy dog; ελληνικό 😃 and then more plain ASCII text" };
+        std::u32string r1 = utf8::runes(text);
+        std::u32string r2 = utf8::runes(text.c_str());
+        ASSERT_EQ(expected, r1, "runes_ascii_runs");
+        ASSERT_EQ(expected, r2, "runes_ascii_runs");
+
+        std::string with_null{ "ABCDEFGHIJKLMNOPQRSTUVWXYZ" };
+        with_null[20] = '\0';
+        std::u32string r3 = utf8::runes(with_null);
+        size_t sz{ r3.size() };
+        ASSERT_EQ(with_null.size(), sz, "runes_ascii_runs");
+    }
+
+
+    { // runes_into
+        std::string_view text{ "abc 😃😎😛 ελληνικό" };
+        size_t n = utf8::length(text);
+        std::vector<char32_t> buf(n);
+        auto res = utf8::runes_into(text, buf);
+        ASSERT_EQ(n, res.count, "runes_into");
+        ASSERT_EQ(utf8::runes_result::npos, res.error, "runes_into");
+        ASSERT_EQ(U'😎', buf[5], "runes_into");
+
+        std::string_view bad{ "abc\xC0\xAF def" }; // overlong '/'
+        res = utf8::runes_into(bad, buf);
+        ASSERT_EQ(3, res.count, "runes_into");
+        ASSERT_EQ(3, res.error, "runes_into");
+
+        // output too small
+        char32_t small[2];
+        res = utf8::runes_into(text, small);
+        ASSERT_EQ(2, res.count, "runes_into");
+        ASSERT_EQ(2, res.error, "runes_into");
+    }
+
+
+    { // stream_decoder
+        std::string text{ "abc 😃😎😛 ελληνικό and some more ASCII to go past one block" };
+        std::u32string expected = utf8::runes(text);
+
+        // feed in chunks of every size, splitting characters at all positions
+        for (size_t chunk = 1; chunk < 8; chunk++) {
+            utf8::stream_decoder dec, val;
+            std::u32string out;
+            bool ok_dec = true, ok_val = true;
+            for (size_t i = 0; i < text.size(); i += chunk) {
+                std::string_view piece{ text.data() + i, std::min(chunk, text.size() - i) };
+                ok_dec = dec.feed(piece, out) && ok_dec;
+                ok_val = val.feed(piece) && ok_val;
+            }
+            ok_dec = dec.finish() && ok_dec;
+            ok_val = val.finish() && ok_val;
+            ASSERT(ok_dec, "stream_decoder");
+            ASSERT(ok_val, "stream_decoder");
+            ASSERT_EQ(expected, out, "stream_decoder");
+        }
+
+        // truncated stream
+        utf8::stream_decoder dec;
+        bool ok = dec.feed("abc\xF0\x9F");
+        bool pending = dec.pending();
+        ASSERT(ok && pending, "stream_decoder");
+        ok = dec.finish();
+        size_t off = dec.error_offset();
+        ASSERT(!ok, "stream_decoder");
+        ASSERT_EQ(3, off, "stream_decoder");
+
+        // invalid encoding in second chunk
+        dec.reset();
+        ok = dec.feed("abc\xE2\x82");
+        ASSERT(ok, "stream_decoder");
+        ok = dec.feed("\xACxyz\xED\xA0\x80");
+        off = dec.error_offset();
+        ASSERT(!ok, "stream_decoder");
+        ASSERT_EQ(9, off, "stream_decoder");
+    }
+
+
     { // dir
         /* Make a folder using Greek alphabet, change current directory into it,
         obtain the current working directory and verify that it matches the name
@@ -3,12 +3,26 @@
 
 
 #include <algorithm>
+#include <array>
+#include <bit>
 #include <cassert>
 #include <cctype>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <sys/stat.h>
+#include <system_error>
+#include <thread>
 #include <vector>
 #ifndef FULL_WINTARD
 #define WIN32_LEAN_AND_MEAN
@@ -58,15 +72,16 @@
 namespace utf8 {
 
 /// Exception thrown on encoding/decoding failure
-struct exception : public std::exception {
+struct exception : public std::runtime_error {
     /// Possible causes
-    enum reason { invalid_utf8, invalid_char32 };
+    enum reason { invalid_utf8, invalid_char32, unmappable };
 
     /// Constructor
     explicit exception(reason c)
-        : std::exception(c == reason::invalid_utf8     ? "Invalid UTF-8 encoding"
-                         : c == reason::invalid_char32 ? "Invalid code-point value"
-                                                       : "Other UTF-8 exception"),
+        : std::runtime_error(c == reason::invalid_utf8     ? "Invalid UTF-8 encoding"
+                             : c == reason::invalid_char32 ? "Invalid code-point value"
+                             : c == reason::unmappable     ? "Character not representable in target encoding"
+                                                           : "Other UTF-8 exception"),
           cause(c) {
     }
 
@@ -77,6 +92,64 @@ struct exception : public std::exception {
 /// Replacement character used for invalid encodings
 constexpr char32_t REPLACEMENT_CHARACTER = 0xfffd;
 
+/// Outcome of a conversion into a caller-supplied buffer
+struct runes_result {
+    /// Value of `error` when the whole input was converted
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    size_t count; ///< number of characters written
+    size_t error; ///< offset of first input byte that was not converted or `npos`
+};
+
+/// Outcome of UTF-8 validation
+struct validation_result {
+    /// Kind of invalid encoding
+    enum error_kind {
+        none, ///< string is valid
+        stray_continuation, ///< continuation byte without a lead byte
+        invalid_byte, ///< byte that never appears in UTF-8 (F8 to FF)
+        overlong, ///< character encoded with more bytes than needed
+        surrogate, ///< UTF-16 surrogate (U+D800 to U+DFFF)
+        too_large, ///< code point above U+10FFFF
+        truncated ///< missing continuation bytes
+    };
+
+    error_kind error; ///< first invalid encoding found
+    size_t offset; ///< offset of first invalid encoding or string size if valid
+
+    /// Return `true` if string is valid
+    explicit operator bool() const {
+        return error == none;
+    }
+};
+
+/// Allocator accepted by the allocator-aware conversion functions; it is rebound to the output character type
+template <typename A>
+concept allocator = requires(A& a) {
+    typename A::value_type;
+    a.deallocate(a.allocate(1), 1);
+};
+
+/// String of `C` characters using allocator `A` rebound to `C`
+template <typename C, typename A>
+using alloc_string = std::basic_string<C, std::char_traits<C>, typename std::allocator_traits<A>::template rebind_alloc<C>>;
+
+/// Implementation details not part of the public interface
+namespace detail {
+
+/// String literal usable as template argument of the compile-time functions
+template <typename C, size_t N>
+struct literal {
+    /// Constructor
+    consteval literal(const C (&input_s)[N]) { // NOLINT(google-explicit-constructor)
+        std::copy_n(input_s, N, str);
+    }
+
+    C str[N]; ///< characters of literal, including terminating null
+};
+
+} // namespace detail
+
 
 /// \addtogroup basecvt
 /// @{
@@ -85,11 +158,56 @@ constexpr char32_t REPLACEMENT_CHARACTER = 0xfffd;
 [[nodiscard]] auto narrow(const char32_t* input_s, size_t nch = 0) -> std::string;
 [[nodiscard]] auto narrow(std::u32string const& input_s) -> std::string;
 [[nodiscard]] auto narrow(char32_t input_r) -> std::string;
+[[nodiscard]] auto narrow(const char16_t* input_s, size_t nch = 0) -> std::string;
+[[nodiscard]] auto narrow(std::u16string const& input_s) -> std::string;
 
 [[nodiscard]] auto widen(const char* input_s, size_t nch = 0) -> std::wstring;
 [[nodiscard]] auto widen(std::string const& input_s) -> std::wstring;
+[[nodiscard]] auto widen16(const char* input_s, size_t nch = 0) -> std::u16string;
+[[nodiscard]] auto widen16(std::string const& input_s) -> std::u16string;
 [[nodiscard]] auto runes(const char* input_s, size_t nch = 0) -> std::u32string;
 [[nodiscard]] auto runes(std::string const& input_s) -> std::u32string;
+[[nodiscard]] auto runes_into(std::string_view input_s, std::span<char32_t> output) -> runes_result;
+
+void narrow_into(std::wstring_view input_s, std::string& output);
+void narrow_into(std::u16string_view input_s, std::string& output);
+void narrow_into(std::u32string_view input_s, std::string& output);
+void widen_into(std::string_view input_s, std::wstring& output);
+void widen_into(std::string_view input_s, std::u16string& output);
+[[nodiscard]] auto runes_into(std::string_view input_s, std::u32string& output) -> runes_result;
+
+[[nodiscard]] auto runes(std::u16string_view input_s) -> std::u32string;
+[[nodiscard]] auto runes(std::wstring_view input_s) -> std::u32string;
+void runes_into(std::u16string_view input_s, std::u32string& output);
+void runes_into(std::wstring_view input_s, std::u32string& output);
+[[nodiscard]] auto widen16(std::u32string_view input_s) -> std::u16string;
+[[nodiscard]] auto widen(std::u32string_view input_s) -> std::wstring;
+void widen_into(std::u32string_view input_s, std::u16string& output);
+void widen_into(std::u32string_view input_s, std::wstring& output);
+
+[[nodiscard]] auto narrow_into(std::wstring_view input_s, std::span<char> output) -> size_t;
+[[nodiscard]] auto narrow_into(std::u16string_view input_s, std::span<char> output) -> size_t;
+[[nodiscard]] auto narrow_into(std::u32string_view input_s, std::span<char> output) -> size_t;
+[[nodiscard]] auto widen_into(std::string_view input_s, std::span<wchar_t> output) -> size_t;
+[[nodiscard]] auto widen_into(std::string_view input_s, std::span<char16_t> output) -> size_t;
+
+template <allocator A>
+[[nodiscard]] auto narrow(std::wstring_view input_s, A const& alloc) -> alloc_string<char, A>;
+template <allocator A>
+[[nodiscard]] auto narrow(std::u16string_view input_s, A const& alloc) -> alloc_string<char, A>;
+template <allocator A>
+[[nodiscard]] auto narrow(std::u32string_view input_s, A const& alloc) -> alloc_string<char, A>;
+template <allocator A>
+[[nodiscard]] auto widen(std::string_view input_s, A const& alloc) -> alloc_string<wchar_t, A>;
+template <allocator A>
+[[nodiscard]] auto widen16(std::string_view input_s, A const& alloc) -> alloc_string<char16_t, A>;
+template <allocator A>
+[[nodiscard]] auto runes(std::string_view input_s, A const& alloc) -> alloc_string<char32_t, A>;
+
+[[nodiscard]] auto from_latin1(std::string_view input_s) -> std::string;
+[[nodiscard]] auto from_cp1252(std::string_view input_s) -> std::string;
+[[nodiscard]] auto to_latin1(std::string_view input_s, std::optional<char> substitute = std::nullopt) -> std::string;
+[[nodiscard]] auto to_cp1252(std::string_view input_s, std::optional<char> substitute = std::nullopt) -> std::string;
 
 [[nodiscard]] auto rune(const char* ptr) -> char32_t;
 [[nodiscard]] auto rune(const std::string::const_iterator& p_check) -> char32_t;
@@ -99,18 +217,52 @@ constexpr char32_t REPLACEMENT_CHARACTER = 0xfffd;
 [[nodiscard]] auto is_valid(std::string::const_iterator ptr, const std::string::const_iterator last) -> bool;
 [[nodiscard]] auto valid_str(const char* input_s, size_t nch = 0) -> bool;
 [[nodiscard]] auto valid_str(std::string const& input_s) -> bool;
+[[nodiscard]] auto validate(std::string_view input_s) -> validation_result;
 
 [[nodiscard]] auto next(std::string::const_iterator& ptr, const std::string::const_iterator last) -> char32_t;
 [[nodiscard]] auto next(const char*& ptr) -> char32_t;
+[[nodiscard]] constexpr auto next(const char*& ptr, const char* last) -> char32_t;
 [[nodiscard]] auto next(char*& ptr) -> char32_t;
 
 [[nodiscard]] auto prev(const char*& ptr) -> char32_t;
 [[nodiscard]] auto prev(char*& ptr) -> char32_t;
 [[nodiscard]] auto prev(std::string::const_iterator& ptr, const std::string::const_iterator first) -> char32_t;
+[[nodiscard]] auto prev(const char*& ptr, const char* first) -> char32_t;
+auto retreat(const char*& ptr, const char* first, size_t n) -> size_t;
 
 [[nodiscard]] auto length(std::string const& input_s) -> size_t;
 [[nodiscard]] auto length(const char* input_s) -> size_t;
+[[nodiscard]] auto length(std::string_view input_s) -> size_t;
 
+/// \addtogroup compile_time
+/// @{
+template <size_t N>
+[[nodiscard]] consteval auto valid_literal(const char (&input_s)[N]) -> bool;
+template <size_t N>
+[[nodiscard]] consteval auto length_literal(const char (&input_s)[N]) -> size_t;
+template <detail::literal S>
+[[nodiscard]] consteval auto runes_literal();
+template <detail::literal S>
+[[nodiscard]] consteval auto narrow_literal();
+/// @}
+
+/// \addtogroup lengths
+/// @{
+[[nodiscard]] auto utf16_length_from_utf8(std::string_view input_s) -> size_t;
+[[nodiscard]] auto utf32_length_from_utf8(std::string_view input_s) -> size_t;
+[[nodiscard]] auto utf8_length_from_utf16(std::u16string_view input_s) -> size_t;
+[[nodiscard]] auto utf32_length_from_utf16(std::u16string_view input_s) -> size_t;
+[[nodiscard]] auto utf8_length_from_utf32(std::u32string_view input_s) -> size_t;
+[[nodiscard]] auto utf16_length_from_utf32(std::u32string_view input_s) -> size_t;
+[[nodiscard]] auto utf8_length_from_latin1(std::string_view input_s) -> size_t;
+[[nodiscard]] auto utf8_length_from_cp1252(std::string_view input_s) -> size_t;
+/// @}
+
+/// \addtogroup parallel
+/// @{
+[[nodiscard]] auto validate_parallel(std::string_view input_s, unsigned int nthreads = 0) -> validation_result;
+[[nodiscard]] auto runes_parallel(std::string_view input_s, unsigned int nthreads = 0) -> std::u32string;
+/// @}
 
 [[nodiscard]] auto get_argv() -> std::vector<std::string>;
 [[nodiscard]] auto get_argv(int32_t* argc) -> char**;
@@ -164,7 +316,16 @@ void make_lower(std::string& str);
 void make_upper(std::string& str);
 [[nodiscard]] auto tolower(std::string const& str) -> std::string;
 [[nodiscard]] auto toupper(std::string const& str) -> std::string;
-[[nodiscard]] auto icompare(std::string const& str1, std::string const& str2) -> int32_t;
+[[nodiscard]] auto tolower_into(std::string_view input_s, std::span<char> output) -> size_t;
+[[nodiscard]] auto toupper_into(std::string_view input_s, std::span<char> output) -> size_t;
+template <allocator A>
+[[nodiscard]] auto tolower(std::string_view input_s, A const& alloc) -> alloc_string<char, A>;
+template <allocator A>
+[[nodiscard]] auto toupper(std::string_view input_s, A const& alloc) -> alloc_string<char, A>;
+[[nodiscard]] auto icompare(std::string_view str1, std::string_view str2) -> int32_t;
+[[nodiscard]] auto icompare_n(std::string_view str1, std::string_view str2, size_t n) -> int32_t;
+[[nodiscard]] auto istarts_with(std::string_view str, std::string_view prefix) -> bool;
+[[nodiscard]] auto iends_with(std::string_view str, std::string_view suffix) -> bool;
 /// @}
 
 /*!
@@ -247,216 +408,878 @@ public:
     }
 };
 
+/// Incremental UTF-8 decoder and validator for input arriving in chunks
+class stream_decoder {
+public:
+    /// Value returned by error_offset() if no error was found
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    auto feed(std::string_view chunk) -> bool;
+    auto feed(std::string_view chunk, std::u32string& output) -> bool;
+    [[nodiscard]] auto finish() -> bool;
+    void reset();
+
+    /// Return `true` if no invalid encoding was found so far
+    [[nodiscard]] auto valid() const -> bool {
+        return err_offset == npos;
+    }
+    /// Return offset in stream of first invalid encoding or `npos`
+    [[nodiscard]] auto error_offset() const -> size_t {
+        return err_offset;
+    }
+    /// Return `true` if the last chunk ended in the middle of a character
+    [[nodiscard]] auto pending() const -> bool {
+        return state != 0 && valid();
+    }
+
+private:
+    auto scan(std::string_view chunk, size_t pos, std::u32string* output) -> bool;
+
+    uint32_t state{}; // decoding automaton state
+    char32_t rune{}; // partially decoded character
+    size_t consumed{}; // bytes fed before current chunk
+    size_t seq_start{}; // stream offset of current character
+    size_t err_offset{ npos };
+};
+
+/// Index of character positions in a UTF-8 string for fast random access
+class string_index {
+public:
+    /// Number of characters between two recorded positions
+    static constexpr size_t stride = 128;
+    /// Value meaning "until end of string" for substr()
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    string_index() = default;
+    explicit string_index(std::string_view p_str);
+
+    [[nodiscard]] auto offset(size_t n) const -> size_t;
+    [[nodiscard]] auto at(size_t n) const -> char32_t;
+    [[nodiscard]] auto substr(size_t pos, size_t count = npos) const -> std::string_view;
+
+    /// Return number of characters in indexed string
+    [[nodiscard]] auto length() const -> size_t {
+        return nchars;
+    }
+    /// Return the indexed string
+    [[nodiscard]] auto view() const -> std::string_view {
+        return str;
+    }
+
+private:
+    std::string_view str;
+    std::vector<size_t> marks; // byte offset of every stride-th character
+    size_t nchars{};
+};
+
+/// View of the characters in a UTF-8 string
+class codepoints : public std::ranges::view_interface<codepoints> {
+public:
+    class iterator;
+
+    codepoints() = default;
+    explicit codepoints(std::string_view p_str)
+        : str(p_str) {
+    }
+
+    [[nodiscard]] auto begin() const -> iterator;
+    [[nodiscard]] auto end() const -> iterator;
+
+    /// Return the underlying string
+    [[nodiscard]] auto view() const -> std::string_view {
+        return str;
+    }
+
+private:
+    std::string_view str;
+};
+
+/// Bidirectional iterator over the characters of a UTF-8 string
+class codepoints::iterator {
+public:
+    using iterator_concept = std::bidirectional_iterator_tag;
+    using iterator_category = std::input_iterator_tag; // dereferencing returns a value
+    using value_type = char32_t;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    iterator(const char* p_ptr, const char* p_first, const char* p_last)
+        : ptr(p_ptr), first(p_first), last(p_last) {
+    }
+
+    [[nodiscard]] auto operator*() const -> char32_t;
+    auto operator++() -> iterator&;
+    auto operator++(int) -> iterator;
+    auto operator--() -> iterator&;
+    auto operator--(int) -> iterator;
+
+    [[nodiscard]] auto operator==(const iterator& other) const -> bool {
+        return ptr == other.ptr;
+    }
+    /// Return pointer to current character
+    [[nodiscard]] auto base() const -> const char* {
+        return ptr;
+    }
+
+private:
+    friend void advance(iterator& it, std::ptrdiff_t n);
+    friend auto distance(iterator from, iterator to) -> std::ptrdiff_t;
+
+    const char* ptr{};
+    const char* first{}; // beginning of string
+    const char* last{}; // end of string
+};
+
+/// Case-insensitive hash of UTF-8 strings, consistent with iequal
+struct ihash {
+    using is_transparent = void; ///< allows lookup with any string type
+
+    [[nodiscard]] auto operator()(std::string_view str) const -> size_t;
+};
+
+/// Case-insensitive equality of UTF-8 strings, same as `icompare(a, b) == 0`
+struct iequal {
+    using is_transparent = void; ///< allows lookup with any string type
+
+    [[nodiscard]] auto operator()(std::string_view a, std::string_view b) const -> bool {
+        return icompare(a, b) == 0;
+    }
+};
+
+void advance(codepoints::iterator& it, std::ptrdiff_t n);
+[[nodiscard]] auto distance(codepoints::iterator from, codepoints::iterator to) -> std::ptrdiff_t;
+
 
 // INLINES --------------------------------------------------------------------
 
 /*!
-  Check if pointer points to a valid UTF-8 encoding
-  \param ptr pointer to string
-  \return `true` if there is a valid UTF-8 encoding at the current pointer position,
-          `false` otherwise.
+  \defgroup dfa UTF-8 Decoding Automaton
+  All scalar decoding and validation goes through a deterministic finite
+  automaton as described by B. Hoehrmann in
+  [Flexible and Economical UTF-8 Decoder](https://bjoern.hoehrmann.de/utf-8/decoder/dfa/).
+
+  Each byte is mapped to one of 12 classes by `dfa_class` and the next state
+  is given by `dfa_next[state + class]`. States are multiples of 12 so that
+  they can be used directly as row offsets in the transition table.
+  The automaton accepts exactly the well-formed byte sequences from the Unicode
+  Standard (chapter 3.9, table 3-7).
+
+  The automaton and the unchecked encode() and decode() functions live in the
+  `utf8::detail` namespace; next(const char*&, const char*) is the public
+  entry point.
 */
-[[nodiscard]] inline auto is_valid(const char* ptr) -> bool {
-    return next(ptr) != REPLACEMENT_CHARACTER;
-}
+
+namespace detail {
+
+/// Automaton state after a complete character
+inline constexpr uint8_t DFA_ACCEPT = 0;
+/// Automaton state after an invalid encoding (absorbing)
+inline constexpr uint8_t DFA_REJECT = 12;
+
+/// Byte classes
+inline constexpr uint8_t dfa_class[256] = {
+    // 00..7F ASCII
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    // 80..8F continuation
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    // 90..9F continuation
+    9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+    // A0..BF continuation
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    // C0..C1 overlong, C2..DF 2-byte lead
+    8, 8, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    // E0, E1..EC, ED, EE..EF 3-byte lead
+    10, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4, 3, 3,
+    // F0, F1..F3, F4 4-byte lead, F5..FF invalid
+    11, 6, 6, 6, 5, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8
+};
+
+/// State transitions
+inline constexpr uint8_t dfa_next[108] = {
+    // accept: expect any lead byte
+    0, 12, 24, 36, 60, 96, 84, 12, 12, 12, 48, 72,
+    // reject
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    // one continuation byte missing
+    12, 0, 12, 12, 12, 12, 12, 0, 12, 0, 12, 12,
+    // two continuation bytes missing
+    12, 24, 12, 12, 12, 12, 12, 24, 12, 24, 12, 12,
+    // after E0: A0..BF
+    12, 12, 12, 12, 12, 12, 12, 24, 12, 12, 12, 12,
+    // after ED: 80..9F
+    12, 24, 12, 12, 12, 12, 12, 12, 12, 24, 12, 12,
+    // after F0: 90..BF
+    12, 12, 12, 12, 12, 12, 12, 36, 12, 36, 12, 12,
+    // after F1..F3: 80..BF
+    12, 36, 12, 12, 12, 12, 12, 36, 12, 36, 12, 12,
+    // after F4: 80..8F
+    12, 36, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12
+};
 
 /*!
-  Check if iterator points to a valid UTF-8 encoding
-  \param ptr    Iterator
-  \param last Iterator pointing to end of range
-  \return `true` if there is a valid UTF-8 encoding at the current iterator position,
-          `false` otherwise.
+  Feed one byte to the decoding automaton
+  \param state current state
+  \param byte  input byte
+  \param rune  character being accumulated
+  \return new state
 */
-[[nodiscard]] inline auto is_valid(std::string::const_iterator ptr, const std::string::const_iterator last) -> bool {
-    return next(ptr, last) != REPLACEMENT_CHARACTER;
+constexpr auto dfa_step(uint32_t state, uint8_t byte, char32_t& rune) -> uint32_t {
+    uint32_t cls = dfa_class[byte];
+    rune = (state != DFA_ACCEPT) ? (rune << 6 | (byte & 0x3Fu)) : ((0xFFu >> cls) & byte);
+    return dfa_next[state + cls];
+}
+
+/// Encode a valid character and return pointer past its encoding. The character is not checked.
+constexpr auto encode(char32_t input_char, char* output) -> char* {
+    if (input_char < 0x80) {
+        *output++ = static_cast<char>(input_char);
+    }
+    else if (input_char < 0x800) {
+        *output++ = static_cast<char>(0xC0 | (input_char >> 6));
+        *output++ = static_cast<char>(0x80 | (input_char & 0x3f));
+    }
+    else if (input_char < 0x10000) {
+        *output++ = static_cast<char>(0xE0 | (input_char >> 12));
+        *output++ = static_cast<char>(0x80 | ((input_char >> 6) & 0x3f));
+        *output++ = static_cast<char>(0x80 | (input_char & 0x3f));
+    }
+    else {
+        *output++ = static_cast<char>(0xF0 | (input_char >> 18));
+        *output++ = static_cast<char>(0x80 | ((input_char >> 12) & 0x3f));
+        *output++ = static_cast<char>(0x80 | ((input_char >> 6) & 0x3f));
+        *output++ = static_cast<char>(0x80 | (input_char & 0x3f));
+    }
+    return output;
 }
 
 /*!
-  Conversion from UTF-8 to UTF-32
+  Decode one character and advance pointer past it
 
-  \param ptr pointer to character
-  \return UTF-32 encoded character or utf8::REPLACEMENT_CHARACTER (0xfffd)
-          if it is an invalid UTF-8 encoding
+  \param ptr   iterator or pointer to character; must be different from `last`
+  \param last  end of string
+  \param rune  decoded character
+  \return `false` if the encoding is invalid
+
+  After an invalid encoding, the pointer is moved to the beginning of next
+  character: the byte that made the encoding invalid is kept unless it is the
+  first byte or a continuation byte.
 */
-[[nodiscard]] inline auto rune(const char* ptr) -> char32_t {
-    return next(ptr);
+template <typename It>
+constexpr auto decode(It& ptr, const It last, char32_t& rune) -> bool {
+    uint32_t state = dfa_step(DFA_ACCEPT, static_cast<uint8_t>(*ptr++), rune);
+    while (state > DFA_REJECT && ptr != last) {
+        state = dfa_step(state, static_cast<uint8_t>(*ptr), rune);
+        if (state != DFA_REJECT) {
+            ++ptr;
+        }
+    }
+    if (state != DFA_ACCEPT) {
+        while (ptr != last && (*ptr & 0xC0) == 0x80) {
+            ++ptr;
+        }
+        rune = REPLACEMENT_CHARACTER;
+        return false;
+    }
+    return true;
 }
 
+} // namespace detail
 
 /*!
   Decodes a UTF-8 encoded character and advances pointer to next character
 
   \param ptr    <b>Reference</b> to character pointer to be advanced
-  \return     decoded character
+  \param last   pointer to end of string
+  \return       decoded character
 
   If the string contains an invalid UTF-8 encoding, the function returns
-  utf8::REPLACEMENT_CHARACTER (0xfffd) and advances pointer to beginning of
-  next character or end of string.
+  REPLACEMENT_CHARACTER (0xfffd) and advances pointer to beginning of next
+  character or end of string. Unlike next(const char*&), the string doesn't
+  need to be null-terminated.
+
+  The function can be used in constant expressions.
 */
-[[nodiscard]] inline auto next(char*& ptr) -> char32_t {
-    return next(const_cast<const char*&>(ptr));
+[[nodiscard]] constexpr auto next(const char*& ptr, const char* last) -> char32_t {
+    char32_t rune;
+    if (ptr == last || !detail::decode(ptr, last, rune)) {
+        return REPLACEMENT_CHARACTER;
+    }
+    return rune;
 }
 
 /*!
-  Decrements a character pointer to previous UTF-8 character
+  \defgroup compile_time Compile-time Functions
+  The scalar codec is `constexpr`, so that characters can be encoded and
+  decoded in constant expressions. The `consteval` functions below turn string
+  literals into arrays at compile time:
 
-  \param ptr    <b>Reference</b> to character pointer to be decremented
-  \return       previous UTF-8 encoded character
+\code
+  static_assert(utf8::valid_literal("ελληνικό"));
+  constexpr auto greek = utf8::runes_literal<"ελληνικό">(); // std::array<char32_t, 8>
+  constexpr auto repl = utf8::narrow_literal<U"\uFFFD">();  // std::array<char, 3>
+\endcode
+*/
 
-  If the string contains an invalid UTF-8 encoding, the function returns
-  REPLACEMENT_CHARACTER (0xfffd) and pointer remains unchanged.
+/*!
+  Verifies at compile time if a string literal is valid UTF-8
+
+  \param input_s string literal
+  \return `true` if literal is a valid UTF-8 encoded string
 */
-[[nodiscard]] inline char32_t prev(char*& ptr) {
-    return prev(const_cast<const char*&>(ptr));
+template <size_t N>
+[[nodiscard]] consteval auto valid_literal(const char (&input_s)[N]) -> bool {
+    uint32_t state = detail::DFA_ACCEPT;
+    for (size_t i = 0; i + 1 < N; i++) {
+        state = detail::dfa_next[state + detail::dfa_class[static_cast<uint8_t>(input_s[i])]];
+    }
+    return state == detail::DFA_ACCEPT;
 }
 
 /*!
-  Creates a new directory
+  Counts at compile time the characters of a string literal
 
-  \param dirname UTF-8 path for new directory
-  \return true if successful, false otherwise
+  \param input_s string literal
+  \return number of characters; an invalid encoding counts as one character
 */
-[[nodiscard]] inline auto mkdir(const char* dirname) -> bool {
-    return (_wmkdir(widen(dirname).c_str()) == 0);
+template <size_t N>
+[[nodiscard]] consteval auto length_literal(const char (&input_s)[N]) -> size_t {
+    const char* ptr = input_s;
+    const char* last = input_s + N - 1;
+    size_t count = 0;
+    while (ptr != last) {
+        (void)next(ptr, last);
+        count++;
+    }
+    return count;
 }
 
 /*!
-  Creates a new directory
+  Converts at compile time a UTF-8 string literal to UTF-32
 
-  \param dirname UTF-8 path for new directory
-  \return true if successful, false otherwise
+  \tparam S UTF-8 encoded string literal; must be valid
+  \return array with the characters of `S`, without terminating null
 */
-[[nodiscard]] inline auto mkdir(std::string const& dirname) -> bool {
-    return (_wmkdir(widen(dirname).c_str()) == 0);
+template <detail::literal S>
+[[nodiscard]] consteval auto runes_literal() {
+    static_assert(valid_literal(S.str), "Invalid UTF-8 encoding");
+    std::array<char32_t, length_literal(S.str)> out{};
+    const char* ptr = S.str;
+    for (auto& r : out) {
+        r = next(ptr, S.str + sizeof(S.str) - 1);
+    }
+    return out;
 }
 
 /*!
-  Deletes a directory
+  Converts at compile time a UTF-32 string literal to UTF-8
 
-  \param dirname UTF-8 path of directory to be removed
-  \return true if successful, false otherwise
+  \tparam S UTF-32 encoded string literal, for instance `U"\uFFFD"`
+  \return array with the UTF-8 encoding of `S`, without terminating null
+
+  A surrogate or a value above 0x10FFFF stops compilation.
 */
-[[nodiscard]] inline auto rmdir(const char* dirname) -> bool {
-    return (_wrmdir(widen(dirname).c_str()) == 0);
+template <detail::literal S>
+[[nodiscard]] consteval auto narrow_literal() {
+    constexpr size_t nbytes = [] {
+        size_t n = 0;
+        for (size_t i = 0; i + 1 < std::size(S.str); i++) {
+            char32_t r = S.str[i];
+            if ((r >= 0xD800 && r <= 0xDFFF) || r > 0x10FFFF) {
+                throw exception(exception::reason::invalid_char32);
+            }
+            n += r < 0x80 ? 1 : r < 0x800 ? 2 : r < 0x10000 ? 3 : 4;
+        }
+        return n;
+    }();
+    std::array<char, nbytes> out{};
+    char* p = out.data();
+    for (size_t i = 0; i + 1 < std::size(S.str); i++) {
+        p = detail::encode(S.str[i], p);
+    }
+    return out;
 }
 
 /*!
-  Deletes a directory
-
-  \param dirname UTF-8 path of directory to be removed
-  \return true if successful, false otherwise
+  Write a string in one pass
+  \param str      string to be filled
+  \param max_size upper bound of string size
+  \param fill     function that writes at most `max_size` characters in the
+                  buffer passed to it and returns the number of characters written
+
+  The string is not initialized before calling `fill`, when the standard
+  library supports `resize_and_overwrite`.
 */
-[[nodiscard]] inline auto rmdir(std::string const& dirname) -> bool {
-    return (_wrmdir(widen(dirname).c_str()) == 0);
+template <typename S, typename F>
+void fill_string(S& str, size_t max_size, F fill) {
+#ifdef __cpp_lib_string_resize_and_overwrite
+    str.resize_and_overwrite(max_size, [&](typename S::value_type* buf, size_t) { return fill(buf); });
+#else
+    str.resize(max_size);
+    str.resize(fill(str.data()));
+#endif
 }
 
+/*!
+  \defgroup alloc Allocator-aware Conversions
+  Conversion functions that take an allocator, for instance a
+  `std::pmr::polymorphic_allocator`, and return a string using that allocator
+  rebound to the output character type. The output is sized exactly before it
+  is written, so no memory is wasted in monotonic arenas.
+
+  Functions in the `utf8::pmr` namespace take a `std::pmr::memory_resource`
+  and return `std::pmr` strings:
+\code
+  std::pmr::monotonic_buffer_resource arena;
+  std::pmr::wstring w = utf8::pmr::widen(text, &arena);
+\endcode
+*/
 
 /*!
-  Changes the current working directory
+  Conversion from wide character to UTF-8 using an allocator
 
-  \param dirname UTF-8 path of new working directory
-  \return true if successful, false otherwise
+  \param input_s input string
+  \param alloc   allocator of output string
+  \return UTF-8 character string
 */
-[[nodiscard]] inline auto chdir(const char* dirname) -> bool {
-    return (_wchdir(widen(dirname).c_str()) == 0);
+template <allocator A>
+[[nodiscard]] auto narrow(std::wstring_view input_s, A const& alloc) -> alloc_string<char, A> {
+    alloc_string<char, A> str(alloc);
+    const size_t nbytes = narrow_into(input_s, std::span<char>());
+    fill_string(str, nbytes, [&](char* buf) { return narrow_into(input_s, std::span<char>(buf, nbytes)); });
+    return str;
 }
 
 /*!
-  Changes the current working directory
+  Conversion from UTF-16 to UTF-8 using an allocator
 
-  \param dirname UTF-8 path of new working directory
-  \return true if successful, false otherwise
+  \param input_s UTF-16 encoded string
+  \param alloc   allocator of output string
+  \return UTF-8 encoded string
+
+  Unpaired surrogates are replaced by REPLACEMENT_CHARACTER (0xfffd).
 */
-[[nodiscard]] inline auto chdir(std::string const& dirname) -> bool {
-    return (_wchdir(widen(dirname).c_str()) == 0);
+template <allocator A>
+[[nodiscard]] auto narrow(std::u16string_view input_s, A const& alloc) -> alloc_string<char, A> {
+    alloc_string<char, A> str(alloc);
+    const size_t nbytes = narrow_into(input_s, std::span<char>());
+    fill_string(str, nbytes, [&](char* buf) { return narrow_into(input_s, std::span<char>(buf, nbytes)); });
+    return str;
 }
 
 /*!
-  Changes the file access permissions
+  Conversion from UTF-32 to UTF-8 using an allocator
 
-  \param filename UTF-8 name of file
-  \param mode access permissions. Or'ed combination of:
-              - _S_IWRITE write permission
-              - _S_IREAD  read permission
+  \param input_s UTF-32 encoded string
+  \param alloc   allocator of output string
+  \return UTF-8 encoded string
 
-  \return true if successful, false otherwise
+  The function throws an exception if the input contains surrogates or
+  values above 0x10FFFF.
 */
-[[nodiscard]] inline auto chmod(const char* filename, int32_t mode) -> bool {
-    return (_wchmod(widen(filename).c_str(), mode) == 0);
+template <allocator A>
+[[nodiscard]] auto narrow(std::u32string_view input_s, A const& alloc) -> alloc_string<char, A> {
+    alloc_string<char, A> str(alloc);
+    const size_t nbytes = narrow_into(input_s, std::span<char>());
+    fill_string(str, nbytes, [&](char* buf) { return narrow_into(input_s, std::span<char>(buf, nbytes)); });
+    return str;
 }
 
 /*!
-  Changes the file access permissions
+  Conversion from UTF-8 to wide character using an allocator
 
-  \param filename UTF-8 name of file
-  \param mode access permissions. Or'ed combination of:
-              - _S_IWRITE write permission
-              - _S_IREAD  read permission
+  \param input_s UTF-8 encoded string
+  \param alloc   allocator of output string
+  \return wide character string
 
-  \return true if successful, false otherwise
+  Invalid encodings are replaced by REPLACEMENT_CHARACTER (0xfffd).
 */
-[[nodiscard]] inline auto chmod(std::string const& filename, int32_t mode) -> bool {
-    return (_wchmod(widen(filename).c_str(), mode) == 0);
+template <allocator A>
+[[nodiscard]] auto widen(std::string_view input_s, A const& alloc) -> alloc_string<wchar_t, A> {
+    alloc_string<wchar_t, A> str(alloc);
+    const size_t nch = widen_into(input_s, std::span<wchar_t>());
+    fill_string(str, nch, [&](wchar_t* buf) { return widen_into(input_s, std::span<wchar_t>(buf, nch)); });
+    return str;
 }
 
-
 /*!
-  Determines if a file has the requested access permissions
+  Conversion from UTF-8 to UTF-16 using an allocator
 
-  \param filename UTF-8 file path of new working directory
-  \param mode required access:
-              - 0 existence only
-              - 2 write permission
-              - 4 read permission
-              - 6 read/write permission
+  \param input_s UTF-8 encoded string
+  \param alloc   allocator of output string
+  \return UTF-16 encoded string
 
-  \return true if successful, false otherwise
+  Invalid encodings are replaced by REPLACEMENT_CHARACTER (0xfffd).
 */
-[[nodiscard]] inline auto access(const char* filename, int32_t mode) -> bool {
-    return (_waccess(widen(filename).c_str(), mode) == 0);
+template <allocator A>
+[[nodiscard]] auto widen16(std::string_view input_s, A const& alloc) -> alloc_string<char16_t, A> {
+    alloc_string<char16_t, A> str(alloc);
+    const size_t nch = widen_into(input_s, std::span<char16_t>());
+    fill_string(str, nch, [&](char16_t* buf) { return widen_into(input_s, std::span<char16_t>(buf, nch)); });
+    return str;
 }
 
 /*!
-  Determines if a file has the requested access permissions
+  Conversion from UTF-8 to UTF-32 using an allocator
 
-  \param filename UTF-8 file path of new working directory
-  \param mode required access:
-              - 0 existence only
-              - 2 write permission
-              - 4 read permission
-              - 6 read/write permission
+  \param input_s UTF-8 encoded string
+  \param alloc   allocator of output string
+  \return UTF-32 encoded string
 
-  \return true if successful, false otherwise
+  The function throws an exception if it encounters an invalid UTF-8 encoding.
 */
-[[nodiscard]] inline auto access(std::string const& filename, int32_t mode) -> bool {
-    return (_waccess(widen(filename).c_str(), mode) == 0);
+template <allocator A>
+[[nodiscard]] auto runes(std::string_view input_s, A const& alloc) -> alloc_string<char32_t, A> {
+    alloc_string<char32_t, A> str(alloc);
+    const size_t nrunes = utf32_length_from_utf8(input_s);
+    runes_result res{};
+    fill_string(str, nrunes, [&](char32_t* buf) {
+        res = runes_into(input_s, std::span<char32_t>(buf, nrunes));
+        return res.count;
+    });
+    if (res.error != runes_result::npos) {
+        throw exception(exception::reason::invalid_utf8);
+    }
+    return str;
 }
 
-
 /*!
-  Delete a file
+  Convert UTF-8 string to lower case using an allocator
 
-  \param filename UTF-8 name of file to be deleted
-  \return true if successful, false otherwise
+  \param input_s UTF-8 string to convert
+  \param alloc   allocator of output string
+  \return lower case UTF-8 string
+
+  The output is first sized like the input; it is resized and converted again
+  only in the rare case when lower case characters need more bytes.
 */
-[[nodiscard]] inline auto remove(const char* filename) -> bool {
-    return (_wremove(widen(filename).c_str()) == 0);
+template <allocator A>
+[[nodiscard]] auto tolower(std::string_view input_s, A const& alloc) -> alloc_string<char, A> {
+    alloc_string<char, A> str(alloc);
+    size_t nbytes = input_s.size();
+    fill_string(str, input_s.size(), [&](char* buf) {
+        nbytes = tolower_into(input_s, std::span<char>(buf, input_s.size()));
+        return std::min(nbytes, input_s.size());
+    });
+    if (nbytes > input_s.size()) {
+        fill_string(str, nbytes, [&](char* buf) { return tolower_into(input_s, std::span<char>(buf, nbytes)); });
+    }
+    return str;
 }
 
 /*!
-  Delete a file
+  Convert UTF-8 string to upper case using an allocator
 
-  \param filename UTF-8 name of file to be deleted
-  \return true if successful, false otherwise
+  \param input_s UTF-8 string to convert
+  \param alloc   allocator of output string
+  \return upper case UTF-8 string
+
+  The output is first sized like the input; it is resized and converted again
+  only in the rare case when upper case characters need more bytes.
 */
-[[nodiscard]] inline auto remove(std::string const& filename) -> bool {
-    return (_wremove(widen(filename).c_str()) == 0);
+template <allocator A>
+[[nodiscard]] auto toupper(std::string_view input_s, A const& alloc) -> alloc_string<char, A> {
+    alloc_string<char, A> str(alloc);
+    size_t nbytes = input_s.size();
+    fill_string(str, input_s.size(), [&](char* buf) {
+        nbytes = toupper_into(input_s, std::span<char>(buf, input_s.size()));
+        return std::min(nbytes, input_s.size());
+    });
+    if (nbytes > input_s.size()) {
+        fill_string(str, nbytes, [&](char* buf) { return toupper_into(input_s, std::span<char>(buf, nbytes)); });
+    }
+    return str;
 }
 
-/*!
-  Rename a file or directory
+namespace pmr {
 
-  \param oldname current UTF-8 encoded name of file or directory
+/// Conversion from wide character to UTF-8 in a memory resource
+[[nodiscard]] inline auto narrow(std::wstring_view input_s, std::pmr::memory_resource* mr = std::pmr::get_default_resource()) -> std::pmr::string {
+    return utf8::narrow(input_s, std::pmr::polymorphic_allocator<char>(mr));
+}
+
+/// Conversion from UTF-16 to UTF-8 in a memory resource
+[[nodiscard]] inline auto narrow(std::u16string_view input_s, std::pmr::memory_resource* mr = std::pmr::get_default_resource()) -> std::pmr::string {
+    return utf8::narrow(input_s, std::pmr::polymorphic_allocator<char>(mr));
+}
+
+/// Conversion from UTF-32 to UTF-8 in a memory resource
+[[nodiscard]] inline auto narrow(std::u32string_view input_s, std::pmr::memory_resource* mr = std::pmr::get_default_resource()) -> std::pmr::string {
+    return utf8::narrow(input_s, std::pmr::polymorphic_allocator<char>(mr));
+}
+
+/// Conversion from UTF-8 to wide character in a memory resource
+[[nodiscard]] inline auto widen(std::string_view input_s, std::pmr::memory_resource* mr = std::pmr::get_default_resource()) -> std::pmr::wstring {
+    return utf8::widen(input_s, std::pmr::polymorphic_allocator<wchar_t>(mr));
+}
+
+/// Conversion from UTF-8 to UTF-16 in a memory resource
+[[nodiscard]] inline auto widen16(std::string_view input_s, std::pmr::memory_resource* mr = std::pmr::get_default_resource()) -> std::pmr::u16string {
+    return utf8::widen16(input_s, std::pmr::polymorphic_allocator<char16_t>(mr));
+}
+
+/// Conversion from UTF-8 to UTF-32 in a memory resource
+[[nodiscard]] inline auto runes(std::string_view input_s, std::pmr::memory_resource* mr = std::pmr::get_default_resource()) -> std::pmr::u32string {
+    return utf8::runes(input_s, std::pmr::polymorphic_allocator<char32_t>(mr));
+}
+
+/// Convert UTF-8 string to lower case in a memory resource
+[[nodiscard]] inline auto tolower(std::string_view input_s, std::pmr::memory_resource* mr = std::pmr::get_default_resource()) -> std::pmr::string {
+    return utf8::tolower(input_s, std::pmr::polymorphic_allocator<char>(mr));
+}
+
+/// Convert UTF-8 string to upper case in a memory resource
+[[nodiscard]] inline auto toupper(std::string_view input_s, std::pmr::memory_resource* mr = std::pmr::get_default_resource()) -> std::pmr::string {
+    return utf8::toupper(input_s, std::pmr::polymorphic_allocator<char>(mr));
+}
+
+} // namespace pmr
+
+/// Return iterator to first character
+[[nodiscard]] inline auto codepoints::begin() const -> iterator {
+    return iterator(str.data(), str.data(), str.data() + str.size());
+}
+
+/// Return iterator past last character
+[[nodiscard]] inline auto codepoints::end() const -> iterator {
+    return iterator(str.data() + str.size(), str.data(), str.data() + str.size());
+}
+
+/*!
+  Return current character
+  \return decoded character or REPLACEMENT_CHARACTER (0xfffd) if the encoding is invalid
+*/
+[[nodiscard]] inline auto codepoints::iterator::operator*() const -> char32_t {
+    const char* p = ptr;
+    return next(p, last);
+}
+
+/// Move to next character. An invalid encoding counts as one character.
+inline auto codepoints::iterator::operator++() -> iterator& {
+    (void)next(ptr, last);
+    return *this;
+}
+
+inline auto codepoints::iterator::operator++(int) -> iterator {
+    iterator tmp = *this;
+    ++*this;
+    return tmp;
+}
+
+inline auto codepoints::iterator::operator--(int) -> iterator {
+    iterator tmp = *this;
+    --*this;
+    return tmp;
+}
+
+/*!
+  Check if pointer points to a valid UTF-8 encoding
+  \param ptr pointer to string
+  \return `true` if there is a valid UTF-8 encoding at the current pointer position,
+          `false` otherwise.
+*/
+[[nodiscard]] inline auto is_valid(const char* ptr) -> bool {
+    return next(ptr) != REPLACEMENT_CHARACTER;
+}
+
+/*!
+  Check if iterator points to a valid UTF-8 encoding
+  \param ptr    Iterator
+  \param last Iterator pointing to end of range
+  \return `true` if there is a valid UTF-8 encoding at the current iterator position,
+          `false` otherwise.
+*/
+[[nodiscard]] inline auto is_valid(std::string::const_iterator ptr, const std::string::const_iterator last) -> bool {
+    return next(ptr, last) != REPLACEMENT_CHARACTER;
+}
+
+/*!
+  Conversion from UTF-8 to UTF-32
+
+  \param ptr pointer to character
+  \return UTF-32 encoded character or utf8::REPLACEMENT_CHARACTER (0xfffd)
+          if it is an invalid UTF-8 encoding
+*/
+[[nodiscard]] inline auto rune(const char* ptr) -> char32_t {
+    return next(ptr);
+}
+
+
+/*!
+  Decodes a UTF-8 encoded character and advances pointer to next character
+
+  \param ptr    <b>Reference</b> to character pointer to be advanced
+  \return     decoded character
+
+  If the string contains an invalid UTF-8 encoding, the function returns
+  utf8::REPLACEMENT_CHARACTER (0xfffd) and advances pointer to beginning of
+  next character or end of string.
+*/
+[[nodiscard]] inline auto next(char*& ptr) -> char32_t {
+    return next(const_cast<const char*&>(ptr));
+}
+
+/*!
+  Decrements a character pointer to previous UTF-8 character
+
+  \param ptr    <b>Reference</b> to character pointer to be decremented
+  \return       previous UTF-8 encoded character
+
+  If the string contains an invalid UTF-8 encoding, the function returns
+  REPLACEMENT_CHARACTER (0xfffd) and pointer remains unchanged.
+*/
+[[nodiscard]] inline char32_t prev(char*& ptr) {
+    return prev(const_cast<const char*&>(ptr));
+}
+
+/*!
+  Creates a new directory
+
+  \param dirname UTF-8 path for new directory
+  \return true if successful, false otherwise
+*/
+[[nodiscard]] inline auto mkdir(const char* dirname) -> bool {
+    return (_wmkdir(widen(dirname).c_str()) == 0);
+}
+
+/*!
+  Creates a new directory
+
+  \param dirname UTF-8 path for new directory
+  \return true if successful, false otherwise
+*/
+[[nodiscard]] inline auto mkdir(std::string const& dirname) -> bool {
+    return (_wmkdir(widen(dirname).c_str()) == 0);
+}
+
+/*!
+  Deletes a directory
+
+  \param dirname UTF-8 path of directory to be removed
+  \return true if successful, false otherwise
+*/
+[[nodiscard]] inline auto rmdir(const char* dirname) -> bool {
+    return (_wrmdir(widen(dirname).c_str()) == 0);
+}
+
+/*!
+  Deletes a directory
+
+  \param dirname UTF-8 path of directory to be removed
+  \return true if successful, false otherwise
+*/
+[[nodiscard]] inline auto rmdir(std::string const& dirname) -> bool {
+    return (_wrmdir(widen(dirname).c_str()) == 0);
+}
+
+
+/*!
+  Changes the current working directory
+
+  \param dirname UTF-8 path of new working directory
+  \return true if successful, false otherwise
+*/
+[[nodiscard]] inline auto chdir(const char* dirname) -> bool {
+    return (_wchdir(widen(dirname).c_str()) == 0);
+}
+
+/*!
+  Changes the current working directory
+
+  \param dirname UTF-8 path of new working directory
+  \return true if successful, false otherwise
+*/
+[[nodiscard]] inline auto chdir(std::string const& dirname) -> bool {
+    return (_wchdir(widen(dirname).c_str()) == 0);
+}
+
+/*!
+  Changes the file access permissions
+
+  \param filename UTF-8 name of file
+  \param mode access permissions. Or'ed combination of:
+              - _S_IWRITE write permission
+              - _S_IREAD  read permission
+
+  \return true if successful, false otherwise
+*/
+[[nodiscard]] inline auto chmod(const char* filename, int32_t mode) -> bool {
+    return (_wchmod(widen(filename).c_str(), mode) == 0);
+}
+
+/*!
+  Changes the file access permissions
+
+  \param filename UTF-8 name of file
+  \param mode access permissions. Or'ed combination of:
+              - _S_IWRITE write permission
+              - _S_IREAD  read permission
+
+  \return true if successful, false otherwise
+*/
+[[nodiscard]] inline auto chmod(std::string const& filename, int32_t mode) -> bool {
+    return (_wchmod(widen(filename).c_str(), mode) == 0);
+}
+
+
+/*!
+  Determines if a file has the requested access permissions
+
+  \param filename UTF-8 file path of new working directory
+  \param mode required access:
+              - 0 existence only
+              - 2 write permission
+              - 4 read permission
+              - 6 read/write permission
+
+  \return true if successful, false otherwise
+*/
+[[nodiscard]] inline auto access(const char* filename, int32_t mode) -> bool {
+    return (_waccess(widen(filename).c_str(), mode) == 0);
+}
+
+/*!
+  Determines if a file has the requested access permissions
+
+  \param filename UTF-8 file path of new working directory
+  \param mode required access:
+              - 0 existence only
+              - 2 write permission
+              - 4 read permission
+              - 6 read/write permission
+
+  \return true if successful, false otherwise
+*/
+[[nodiscard]] inline auto access(std::string const& filename, int32_t mode) -> bool {
+    return (_waccess(widen(filename).c_str(), mode) == 0);
+}
+
+
+/*!
+  Delete a file
+
+  \param filename UTF-8 name of file to be deleted
+  \return true if successful, false otherwise
+*/
+[[nodiscard]] inline auto remove(const char* filename) -> bool {
+    return (_wremove(widen(filename).c_str()) == 0);
+}
+
+/*!
+  Delete a file
+
+  \param filename UTF-8 name of file to be deleted
+  \return true if successful, false otherwise
+*/
+[[nodiscard]] inline auto remove(std::string const& filename) -> bool {
+    return (_wremove(widen(filename).c_str()) == 0);
+}
+
+/*!
+  Rename a file or directory
+
+  \param oldname current UTF-8 encoded name of file or directory
   \param newname new UTF-8 name
   \return true if successful, false otherwise
 */
@@ -682,6 +1505,10 @@ public:
 
 }; // namespace utf8
 
+/// A codepoints view doesn't own the string; its iterators remain valid after the view is gone
+template <>
+inline constexpr bool std::ranges::enable_borrowed_range<utf8::codepoints> = true;
+
 
 //
 //
@@ -694,10 +1521,67 @@ public:
 //
 #ifdef UTF8_IMPLEMENTATION
 
+#if defined(_M_X64) || defined(__x86_64__)
+#define UTF8_SIMD_X64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define UTF8_TARGET_AVX2
+#define UTF8_NO_SANITIZE_ADDRESS __declspec(no_sanitize_address)
+#else
+#include <cpuid.h>
+#define UTF8_TARGET_AVX2 __attribute__((target("avx2")))
+#define UTF8_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#endif
+#endif
+
 
 namespace utf8 {
 
-static void encode(char32_t input_char, std::string& input_s);
+static auto encoded_size(const char32_t* input_s, size_t nch) -> size_t;
+static void utf32_to_utf8(const char32_t* input_s, size_t nch, char* out);
+static auto validate_buf(const char* input_s, size_t nch) -> bool;
+static auto classify_error(const char* ptr, const char* last) -> validation_result::error_kind;
+static auto ascii_run(const char* input_s, size_t nch) -> size_t;
+static auto ascii_case(const char* input_s, size_t nch, char* out, bool upper) -> size_t;
+template <typename C>
+static void widen_ascii(const char* input_s, size_t nch, C* out);
+template <typename C>
+static auto utf8_to_wide(const char* input_s, size_t nch, C* out) -> size_t;
+template <typename C>
+static auto wide_to_utf8(const C* input_s, size_t nch, char* out) -> size_t;
+template <typename C>
+static auto next_wide(const C* input_s, size_t& i, size_t nch) -> char32_t;
+template <typename C>
+static auto wide_to_utf32(const C* input_s, size_t nch, char32_t* out) -> size_t;
+static auto utf16_size(const char32_t* input_s, size_t nch) -> size_t;
+template <typename C>
+static void utf32_to_wide(const char32_t* input_s, size_t nch, C* out);
+template <typename C>
+static auto encode_utf16(char32_t input_char, C* output) -> C*;
+static auto single_byte_utf8_size(std::string_view input_s, const char16_t* high_map) -> size_t;
+static auto single_byte_to_utf8(std::string_view input_s, const char16_t* high_map) -> std::string;
+static auto utf8_to_single_byte(std::string_view input_s, const char16_t* high_map, std::optional<char> substitute) -> std::string;
+static auto split_utf8(std::string_view input_s, unsigned int nthreads) -> std::vector<size_t>;
+template <typename F>
+static void run_parallel(size_t nchunks, F work);
+
+/// Code points of Windows-1252 characters 0x80 to 0x9F. Undefined values map to C1 controls.
+static constexpr char16_t cp1252_high[32] = {
+    0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021, 0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+    0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014, 0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178
+};
+
+/// Upper bound of UTF-8 bytes produced by one UTF-16 or UTF-32 character
+template <typename C>
+constexpr size_t MAX_UTF8_PER_WIDE = sizeof(C) == 2 ? 3 : 4;
+
+/// Smallest chunk handed to a worker thread by the parallel functions
+constexpr size_t PARALLEL_MIN_CHUNK = 256 * 1024;
+static auto count_runes(const char* input_s, size_t nch) -> size_t;
+static auto skip_runes(const char* ptr, const char* last, size_t n) -> const char*;
+template <typename It>
+static auto decode_prev(It& ptr, const It first, char32_t& rune) -> bool;
 
 /*!
   \defgroup basecvt Narrowing/Widening Functions
@@ -712,17 +1596,13 @@ static void encode(char32_t input_char, std::string& input_s);
   \return UTF-8 character string
 */
 [[nodiscard]] auto narrow(const wchar_t* input_s, size_t nch) -> std::string {
-    int32_t nsz{ WideCharToMultiByte(CP_UTF8, 0, input_s, (nch != 0U ? static_cast<int>(nch) : -1), nullptr, 0, nullptr, nullptr) };
-    if ((input_s == nullptr) || (nsz == 0)) {
+    if (input_s == nullptr) {
         return std::string();
     }
-
-    auto out{ std::string(static_cast<size_t>(nsz), 0) };
-    WideCharToMultiByte(CP_UTF8, 0, input_s, -1, out.data(), nsz, nullptr, nullptr);
     if (nch == 0U) {
-        out.resize(static_cast<size_t>(nsz - 1)); // output is null-terminated
+        nch = wcslen(input_s);
     }
-    return out;
+    return narrow(std::wstring_view(input_s, nch), std::allocator<char>());
 }
 
 /*!
@@ -732,40 +1612,82 @@ static void encode(char32_t input_char, std::string& input_s);
   \return UTF-8 character string
 */
 [[nodiscard]] auto narrow(std::wstring const& input_s) -> std::string {
-    int32_t nsz{ WideCharToMultiByte(CP_UTF8, 0, input_s.c_str(), static_cast<int>(input_s.size()), nullptr, 0, nullptr, nullptr) };
-    if (nsz == 0) {
-        return std::string();
-    }
-    auto out{ std::string(static_cast<size_t>(nsz), 0) };
-    WideCharToMultiByte(CP_UTF8, 0, input_s.c_str(), static_cast<int>(input_s.size()), out.data(), static_cast<int>(nsz), nullptr, nullptr);
-    return out;
+    return narrow(std::wstring_view(input_s), std::allocator<char>());
 }
 
 /*!
-  Conversion from UTF32 to UTF8
-  \param input_s UTF-32 encoded string
-  \param  nch number of character to convert or 0 if string is null-terminated
-  \return UTF-8 encoded string
+  Conversion from wide character to UTF-8 into an existing string
+
+  \param  input_s input string
+  \param  output  UTF-8 character string
 
-  Each character in the input string should be a valid UTF-32 code point
-  ( <0x10FFFF)
+  The previous content of `output` is replaced; its capacity is reused.
 */
-[[nodiscard]] auto narrow(const char32_t* input_s, size_t nch) -> std::string {
-    auto str{ std::string() };
-    const char32_t* p{ input_s };
+void narrow_into(std::wstring_view input_s, std::string& output) {
+    fill_string(output, MAX_UTF8_PER_WIDE<wchar_t> * input_s.size(), [&](char* buf) { return wide_to_utf8(input_s.data(), input_s.size(), buf); });
+}
+
+/*!
+  Conversion from UTF-16 to UTF-8
+
+  \param  input_s UTF-16 encoded string
+  \param  nch number of character to convert or 0 if string is null-terminated
+  \return UTF-8 character string
+
+  Unpaired surrogates are replaced by REPLACEMENT_CHARACTER (0xfffd).
+*/
+[[nodiscard]] auto narrow(const char16_t* input_s, size_t nch) -> std::string {
+    if (input_s == nullptr) {
+        return std::string();
+    }
     if (nch == 0U) {
-        // null terminated; count characters now
-        while (*p++) {
-            nch++;
-        }
-        p = input_s;
+        nch = std::char_traits<char16_t>::length(input_s);
     }
+    return narrow(std::u16string_view(input_s, nch), std::allocator<char>());
+}
+
+/*!
+  Conversion from UTF-16 to UTF-8
+
+  \param  input_s UTF-16 encoded string
+  \return UTF-8 character string
+
+  Unpaired surrogates are replaced by REPLACEMENT_CHARACTER (0xfffd).
+*/
+[[nodiscard]] auto narrow(std::u16string const& input_s) -> std::string {
+    return narrow(std::u16string_view(input_s), std::allocator<char>());
+}
+
+/*!
+  Conversion from UTF-16 to UTF-8 into an existing string
+
+  \param  input_s UTF-16 encoded string
+  \param  output  UTF-8 character string
+
+  Unpaired surrogates are replaced by REPLACEMENT_CHARACTER (0xfffd).
+  The previous content of `output` is replaced; its capacity is reused.
+*/
+void narrow_into(std::u16string_view input_s, std::string& output) {
+    fill_string(output, MAX_UTF8_PER_WIDE<char16_t> * input_s.size(), [&](char* buf) { return wide_to_utf8(input_s.data(), input_s.size(), buf); });
+}
+
+/*!
+  Conversion from UTF32 to UTF8
+  \param input_s UTF-32 encoded string
+  \param  nch number of character to convert or 0 if string is null-terminated
+  \return UTF-8 encoded string
 
-    for (; nch != 0U; nch--, ++p) {
-        assert(*p < 0x10ffff);
-        encode(*p, str);
+  Each character in the input string must be a valid UTF-32 code point
+  (<= 0x10FFFF and not a surrogate) otherwise the function throws a
+  utf8::exception.
+*/
+[[nodiscard]] auto narrow(const char32_t* input_s, size_t nch) -> std::string {
+    if (nch == 0U) {
+        nch = std::char_traits<char32_t>::length(input_s);
     }
-    return str;
+    std::string out;
+    narrow_into(std::u32string_view(input_s, nch), out);
+    return out;
 }
 
 /*!
@@ -773,16 +1695,14 @@ static void encode(char32_t input_char, std::string& input_s);
   \param input_s UTF-32 encoded string
   \return UTF-8 encoded string
 
-  Each character in the input string should be a valid UTF-32 code point
-  ( <0x10FFFF)
+  Each character in the input string must be a valid UTF-32 code point
+  (<= 0x10FFFF and not a surrogate) otherwise the function throws a
+  utf8::exception.
 */
 [[nodiscard]] auto narrow(std::u32string const& input_s) -> std::string {
-    auto str{ std::string() };
-    for (auto p = input_s.begin(); p != input_s.end(); ++p) {
-        assert(*p < 0x10ffff);
-        encode(*p, str);
-    }
-    return str;
+    std::string out;
+    narrow_into(input_s, out);
+    return out;
 }
 
 /*!
@@ -790,14 +1710,31 @@ static void encode(char32_t input_char, std::string& input_s);
   \param input_r UTF-32 encoded character
   \return UTF-8 encoded string
 
-  Input parameter must be a valid UTF-32 code point
-  ( <0x10FFFF)
+  Input parameter must be a valid UTF-32 code point (<= 0x10FFFF and not a
+  surrogate) otherwise the function throws a utf8::exception.
 */
 [[nodiscard]] auto narrow(const char32_t input_r) -> std::string {
-    assert(input_r < 0x10ffff);
-    auto str{ std::string() };
-    encode(input_r, str);
-    return str;
+    std::string out;
+    narrow_into(std::u32string_view(&input_r, 1), out);
+    return out;
+}
+
+/*!
+  Conversion from UTF32 to UTF8 into an existing string
+  \param input_s UTF-32 encoded string
+  \param output  UTF-8 encoded string
+
+  Each character in the input string must be a valid UTF-32 code point
+  (<= 0x10FFFF and not a surrogate) otherwise the function throws a
+  utf8::exception and `output` is not changed.
+  The previous content of `output` is replaced; its capacity is reused.
+*/
+void narrow_into(std::u32string_view input_s, std::string& output) {
+    const size_t nbytes = encoded_size(input_s.data(), input_s.size());
+    fill_string(output, nbytes, [&](char* buf) {
+        utf32_to_utf8(input_s.data(), input_s.size(), buf);
+        return nbytes;
+    });
 }
 
 /*!
@@ -808,17 +1745,13 @@ static void encode(char32_t input_char, std::string& input_s);
   \return wide character string
 */
 [[nodiscard]] auto widen(const char* input_s, size_t nch) -> std::wstring {
-    int32_t wsz{ MultiByteToWideChar(CP_UTF8, 0, input_s, (nch != 0U ? static_cast<int>(nch) : -1), nullptr, 0) };
-    if ((input_s == nullptr) || (wsz == 0)) {
+    if (input_s == nullptr) {
         return std::wstring();
     }
-
-    auto out{ std::wstring(static_cast<size_t>(wsz), 0) };
-    MultiByteToWideChar(CP_UTF8, 0, input_s, -1, out.data(), wsz);
     if (nch == 0U) {
-        out.resize(static_cast<size_t>(wsz - 1)); // output is null-terminated
+        nch = strlen(input_s);
     }
-    return out;
+    return widen(std::string_view(input_s, nch), std::allocator<wchar_t>());
 }
 
 /*!
@@ -828,14 +1761,64 @@ static void encode(char32_t input_char, std::string& input_s);
   \return wide character string
 */
 [[nodiscard]] auto widen(std::string const& input_s) -> std::wstring {
-    int32_t wsz{ MultiByteToWideChar(CP_UTF8, 0, input_s.c_str(), static_cast<int>(input_s.size()), nullptr, 0) };
-    if (wsz == 0) {
-        return std::wstring();
+    return widen(std::string_view(input_s), std::allocator<wchar_t>());
+}
+
+/*!
+  Conversion from UTF-8 to wide character into an existing string
+
+  \param  input_s input string
+  \param  output  wide character string
+
+  Invalid encodings are replaced by REPLACEMENT_CHARACTER (0xfffd).
+  The previous content of `output` is replaced; its capacity is reused.
+*/
+void widen_into(std::string_view input_s, std::wstring& output) {
+    fill_string(output, input_s.size(), [&](wchar_t* buf) { return utf8_to_wide(input_s.data(), input_s.size(), buf); });
+}
+
+/*!
+  Conversion from UTF-8 to UTF-16
+
+  \param  input_s input string
+  \param  nch number of characters to convert or 0 if string is null-terminated
+  \return UTF-16 encoded string
+
+  Invalid encodings are replaced by REPLACEMENT_CHARACTER (0xfffd).
+*/
+[[nodiscard]] auto widen16(const char* input_s, size_t nch) -> std::u16string {
+    if (input_s == nullptr) {
+        return std::u16string();
+    }
+    if (nch == 0U) {
+        nch = strlen(input_s);
     }
+    return widen16(std::string_view(input_s, nch), std::allocator<char16_t>());
+}
 
-    auto out{ std::wstring(static_cast<size_t>(wsz), 0) };
-    MultiByteToWideChar(CP_UTF8, 0, input_s.c_str(), static_cast<int>(input_s.size()), out.data(), static_cast<int>(wsz));
-    return out;
+/*!
+  Conversion from UTF-8 to UTF-16
+
+  \param  input_s input string
+  \return UTF-16 encoded string
+
+  Invalid encodings are replaced by REPLACEMENT_CHARACTER (0xfffd).
+*/
+[[nodiscard]] auto widen16(std::string const& input_s) -> std::u16string {
+    return widen16(std::string_view(input_s), std::allocator<char16_t>());
+}
+
+/*!
+  Conversion from UTF-8 to UTF-16 into an existing string
+
+  \param  input_s input string
+  \param  output  UTF-16 encoded string
+
+  Invalid encodings are replaced by REPLACEMENT_CHARACTER (0xfffd).
+  The previous content of `output` is replaced; its capacity is reused.
+*/
+void widen_into(std::string_view input_s, std::u16string& output) {
+    fill_string(output, input_s.size(), [&](char16_t* buf) { return utf8_to_wide(input_s.data(), input_s.size(), buf); });
 }
 
 /*!
@@ -846,21 +1829,16 @@ static void encode(char32_t input_char, std::string& input_s);
   \return UTF-32 encoded string
 
   The function throws an exception if it encounters an invalid UTF-8 encoding.
+  Runs of ASCII characters are copied in bulk, bypassing the decoder.
 */
 [[nodiscard]] auto runes(const char* input_s, size_t nch) -> std::u32string {
-    std::u32string str;
     if (nch == 0U) {
         nch = strlen(input_s);
     }
 
-    const char* end = input_s + nch;
-
-    while (input_s < end) {
-        char32_t r = next(input_s);
-        if (r == REPLACEMENT_CHARACTER) {
-            throw exception(exception::reason::invalid_utf8);
-        }
-        str.push_back(r);
+    std::u32string str;
+    if (runes_into(std::string_view(input_s, nch), str).error != runes_result::npos) {
+        throw exception(exception::reason::invalid_utf8);
     }
     return str;
 }
@@ -872,591 +1850,2369 @@ static void encode(char32_t input_char, std::string& input_s);
   \return UTF-32 encoded string
 
   The function throws an exception if it encounters an invalid UTF-8 encoding.
+  Runs of ASCII characters are copied in bulk, bypassing the decoder.
 */
 [[nodiscard]] auto runes(std::string const& input_s) -> std::u32string {
     std::u32string str;
-    auto ptr = input_s.cbegin();
-    while (ptr != input_s.cend()) {
-        char32_t r = next(ptr, input_s.cend());
-        if (r != REPLACEMENT_CHARACTER) {
-            str.push_back(r);
-        }
-        else {
-            throw exception(exception::reason::invalid_utf8);
-        }
+    if (runes_into(input_s, str).error != runes_result::npos) {
+        throw exception(exception::reason::invalid_utf8);
     }
     return str;
 }
 
-
 /*!
-  Verifies if string is a valid UTF-8 string
+  Converts a string of characters from UTF-8 to UTF-32 into an existing string
 
-  \param input_s pointer to character string to verify
-  \param nch number of characters to verify or 0 if string is null-terminated
-  \return `true` if string is a valid UTF-8 encoded string, `false` otherwise
-*/
-[[nodiscard]] auto valid_str(const char* input_s, size_t nch) -> bool {
-    if (nch == 0U) {
-        nch = strlen(input_s);
-    }
+  \param input_s UTF-8 encoded string
+  \param output  UTF-32 encoded string
+  \return number of characters written and offset of the first invalid
+          encoding, as for runes_into(std::string_view, std::span<char32_t>)
 
-    const char* last = input_s + nch;
-    while (input_s < last) {
-        if (next(input_s) == REPLACEMENT_CHARACTER) {
-            return false;
-        }
-    }
-    return (input_s == last);
+  The function doesn't throw on invalid UTF-8: conversion stops at the first
+  invalid encoding and `output` holds the characters before it.
+  The previous content of `output` is replaced; its capacity is reused.
+*/
+[[nodiscard]] auto runes_into(std::string_view input_s, std::u32string& output) -> runes_result {
+    const size_t nrunes = count_runes(input_s.data(), input_s.size());
+    runes_result res{};
+    fill_string(output, nrunes, [&](char32_t* buf) {
+        res = runes_into(input_s, std::span<char32_t>(buf, nrunes));
+        return res.count;
+    });
+    return res;
 }
 
 /*!
-  Decodes a UTF-8 encoded character and advances iterator to next code point
+  Conversion from UTF-16 to UTF-32
 
-  \param ptr    Reference to iterator to be advanced
-  \param last   Iterator pointing to the end of range
-  \return       decoded character
+  \param input_s UTF-16 encoded string
+  \return UTF-32 encoded string
 
-  If the string contains an invalid UTF-8 encoding, the function returns
-  REPLACEMENT_CHARACTER (0xfffd) and advances pointer to beginning of next
-  character or end of string.
+  Unpaired surrogates are replaced by REPLACEMENT_CHARACTER (0xfffd).
 */
-[[nodiscard]] auto next(std::string::const_iterator& ptr, const std::string::const_iterator last) -> char32_t {
-    char32_t rune = 0;
-    if (ptr == last) {
-        return REPLACEMENT_CHARACTER;
-    }
+[[nodiscard]] auto runes(std::u16string_view input_s) -> std::u32string {
+    std::u32string str;
+    runes_into(input_s, str);
+    return str;
+}
 
-    if ((*ptr & 0x80) == 0) {
-        return static_cast<char32_t>(*ptr++);
-    }
-    else if ((*ptr & 0xC0) == 0x80) {
-        rune = REPLACEMENT_CHARACTER;
-        do {
-            ++ptr;
-        }
-        while (ptr != last && (*ptr & 0x80) == 0x80);
-    }
-    else {
-        size_t cont = 0;
-        if ((*ptr & 0xE0) == 0xC0) {
-            cont = 1;
-            rune = static_cast<char32_t>(*ptr++ & 0x1f);
-        }
-        else if ((*ptr & 0xF0) == 0xE0) {
-            cont = 2;
-            rune = static_cast<char32_t>(*ptr++ & 0x0f);
-        }
-        else if ((*ptr & 0xF8) == 0xF0) {
-            cont = 3;
-            rune = static_cast<char32_t>(*ptr++ & 0x07);
-        }
-        else {
-            do {
-                ++ptr;
-            }
-            while (ptr != last && (*ptr & 0xC0) == 0x80);
-            return REPLACEMENT_CHARACTER; // code points > U+0x10FFFF are invalid
-        }
-        size_t i;
-        for (i = 0; i < cont && ptr != last && (*ptr & 0xC0) == 0x80; i++) {
-            rune <<= 6;
-            rune += *ptr++ & 0x3f;
-        }
+/*!
+  Conversion from wide character to UTF-32
 
-        // sanity checks
-        if (i != cont) {
-            return REPLACEMENT_CHARACTER; // short encoding
-        }
-        if (0xD800 <= rune && rune <= 0xdfff) {
-            return REPLACEMENT_CHARACTER; // surrogates (U+D000 to U+DFFF) are invalid
-        }
+  \param input_s wide character string
+  \return UTF-32 encoded string
 
-        if (rune < 0x80 || (cont > 1 && rune < 0x800) || (cont > 2 && rune < 0x10000)) {
-            return REPLACEMENT_CHARACTER; // overlong encoding
-        }
-    }
-    return rune;
+  Unpaired surrogates and values above 0x10FFFF are replaced by
+  REPLACEMENT_CHARACTER (0xfffd).
+*/
+[[nodiscard]] auto runes(std::wstring_view input_s) -> std::u32string {
+    std::u32string str;
+    runes_into(input_s, str);
+    return str;
 }
 
 /*!
-  Decodes a UTF-8 encoded character and Advances pointer to next character
+  Conversion from UTF-16 to UTF-32 into an existing string
 
-  \param ptr    <b>Reference</b> to character pointer to be advanced
-  \return       decoded character
+  \param input_s UTF-16 encoded string
+  \param output  UTF-32 encoded string
 
-  If the string contains an invalid UTF-8 encoding, the function returns
-  REPLACEMENT_CHARACTER (0xfffd) and advances pointer to beginning of next
-  character or end of string.
+  Unpaired surrogates are replaced by REPLACEMENT_CHARACTER (0xfffd).
+  The previous content of `output` is replaced; its capacity is reused.
 */
-[[nodiscard]] auto next(const char*& ptr) -> char32_t {
-    char32_t rune = 0;
-    if ((*ptr & 0x80) == 0) {
-        if ((rune = static_cast<char32_t>(*ptr)) != 0) {
-            ++ptr;
-        }
-    }
-    else if ((*ptr & 0xC0) == 0x80) {
-        rune = REPLACEMENT_CHARACTER;
-        do {
-            ptr++;
-        }
-        while (*ptr && (*ptr & 0x80) == 0x80);
-    }
-    else {
-        size_t cont = 0;
-        if ((*ptr & 0xE0) == 0xC0) {
-            cont = 1;
-            rune = static_cast<char32_t>(*ptr++ & 0x1f);
-        }
-        else if ((*ptr & 0xF0) == 0xE0) {
-            cont = 2;
-            rune = static_cast<char32_t>(*ptr++ & 0x0f);
-        }
-        else if ((*ptr & 0xF8) == 0xF0) {
-            cont = 3;
-            rune = static_cast<char32_t>(*ptr++ & 0x07);
-        }
-        else {
-            do {
-                ptr++;
-            }
-            while (*ptr && (*ptr & 0xC0) == 0x80);
-            return REPLACEMENT_CHARACTER; // code points > U+0x10FFFF are invalid
-        }
-        size_t i;
-        for (i = 0; i < cont && (*ptr & 0xC0) == 0x80; i++) {
-            rune <<= 6;
-            rune += *ptr++ & 0x3f;
-        }
-
-        // sanity checks
-        if (i != cont) {
-            return REPLACEMENT_CHARACTER; // short encoding
-        }
-        if (0xD800 <= rune && rune <= 0xdfff) {
-            return REPLACEMENT_CHARACTER; // surrogates (U+D000 to U+DFFF) are invalid
-        }
-
-        if (rune < 0x80 || (cont > 1 && rune < 0x800) || (cont > 2 && rune < 0x10000)) {
-            return REPLACEMENT_CHARACTER; // overlong encoding
-        }
-    }
-    return rune;
+void runes_into(std::u16string_view input_s, std::u32string& output) {
+    fill_string(output, input_s.size(), [&](char32_t* buf) { return wide_to_utf32(input_s.data(), input_s.size(), buf); });
 }
 
 /*!
-  Decrements a character pointer to previous UTF-8 character
+  Conversion from wide character to UTF-32 into an existing string
 
-  \param ptr    <b>Reference</b> to character pointer to be decremented
-  \return       previous UTF-8 encoded character
+  \param input_s wide character string
+  \param output  UTF-32 encoded string
 
-  If the string contains an invalid UTF-8 encoding, the function returns
-  REPLACEMENT_CHARACTER (0xfffd) and pointer remains unchanged.
+  Unpaired surrogates and values above 0x10FFFF are replaced by
+  REPLACEMENT_CHARACTER (0xfffd).
+  The previous content of `output` is replaced; its capacity is reused.
 */
-[[nodiscard]] auto prev(const char*& ptr) -> char32_t {
-    int32_t cont{};
-    const char* in_ptr = ptr;
-    char32_t rune{};
-    uint8_t ch{};
-    while (((ch = static_cast<uint8_t>(*--ptr)) & 0xc0) == 0x80 && cont < 3) {
-        rune += static_cast<char32_t>(ch & 0x3f) << cont++ * 6;
-    }
-    if (cont == 3 && (ch & 0xF0) == 0xF0) {
-        rune += static_cast<char32_t>(ch & 0x0f) << 18;
-    }
-    else if (cont == 2 && (ch & 0xE0) == 0xE0) {
-        rune += static_cast<char32_t>(ch & 0x1f) << 12;
-    }
-    else if (cont == 1 && (ch & 0xC0) == 0xC0) {
-        rune += static_cast<char32_t>(ch & 0x3f) << 6;
-    }
-    else if (cont == 0 && ch < 0x7f) {
-        rune += ch;
-    }
-    else {
-        ptr = in_ptr;
-        return REPLACEMENT_CHARACTER;
-    }
+void runes_into(std::wstring_view input_s, std::u32string& output) {
+    fill_string(output, input_s.size(), [&](char32_t* buf) { return wide_to_utf32(input_s.data(), input_s.size(), buf); });
+}
 
-    if ((0xD800 <= rune && rune <= 0xdfff) // surrogate
-        || (cont >= 0 && rune < 0x80) || (cont >= 1 && rune < 0x800) || (cont >= 2 && rune < 0x10000)) // overlong encoding
-    {
-        ptr = in_ptr;
-        return REPLACEMENT_CHARACTER;
-    }
+/*!
+  Conversion from UTF-32 to UTF-16
 
-    return rune;
+  \param input_s UTF-32 encoded string
+  \return UTF-16 encoded string
+
+  Each character in the input string must be a valid UTF-32 code point
+  (<= 0x10FFFF and not a surrogate) otherwise the function throws a
+  utf8::exception.
+*/
+[[nodiscard]] auto widen16(std::u32string_view input_s) -> std::u16string {
+    std::u16string out;
+    widen_into(input_s, out);
+    return out;
 }
 
 /*!
-  Decrements an iterator to previous UTF-8 character
+  Conversion from UTF-32 to wide character
 
-  \param ptr    iterator to be decremented
-  \param first  iterator pointing to beginning of string
-  \return       previous UTF-8 encoded character
+  \param input_s UTF-32 encoded string
+  \return wide character string
 
-  If the string contains an invalid UTF-8 encoding, the function returns
-  REPLACEMENT_CHARACTER (0xfffd) and iterator remains unchanged.
+  Each character in the input string must be a valid UTF-32 code point
+  (<= 0x10FFFF and not a surrogate) otherwise the function throws a
+  utf8::exception.
 */
-[[nodiscard]] auto prev(std::string::const_iterator& ptr, const std::string::const_iterator first) -> char32_t {
-    int32_t cont{};
-    auto in_ptr = ptr;
-    char32_t rune{};
-    uint8_t ch{};
-    while (((ch = static_cast<uint8_t>(*--ptr)) & 0xc0) == 0x80 && cont < 3 && ptr > first) {
-        rune += static_cast<char32_t>(ch & 0x3f) << cont++ * 6;
-    }
-    if (cont == 3 && (ch & 0xF0) == 0xF0) {
-        rune += static_cast<char32_t>(ch & 0x0f) << 18;
-    }
-    else if (cont == 2 && (ch & 0xE0) == 0xE0) {
-        rune += static_cast<char32_t>(ch & 0x1f) << 12;
-    }
-    else if (cont == 1 && (ch & 0xC0) == 0xC0) {
-        rune += static_cast<char32_t>(ch & 0x3f) << 6;
-    }
-    else if (cont == 0 && ch < 0x7f) {
-        rune += ch;
-    }
-    else {
-        ptr = in_ptr;
-        return REPLACEMENT_CHARACTER;
-    }
+[[nodiscard]] auto widen(std::u32string_view input_s) -> std::wstring {
+    std::wstring out;
+    widen_into(input_s, out);
+    return out;
+}
 
-    if ((0xD800 <= rune && rune <= 0xdfff) // surrogate
-        || (cont >= 0 && rune < 0x80) || (cont >= 1 && rune < 0x800) || (cont >= 2 && rune < 0x10000)) // overlong encoding
-    {
-        ptr = in_ptr;
-        return REPLACEMENT_CHARACTER;
-    }
+/*!
+  Conversion from UTF-32 to UTF-16 into an existing string
 
-    return rune;
+  \param input_s UTF-32 encoded string
+  \param output  UTF-16 encoded string
+
+  Each character in the input string must be a valid UTF-32 code point
+  (<= 0x10FFFF and not a surrogate) otherwise the function throws a
+  utf8::exception and `output` is not changed.
+  The previous content of `output` is replaced; its capacity is reused.
+*/
+void widen_into(std::u32string_view input_s, std::u16string& output) {
+    const size_t nunits = utf16_size(input_s.data(), input_s.size());
+    fill_string(output, nunits, [&](char16_t* buf) {
+        utf32_to_wide(input_s.data(), input_s.size(), buf);
+        return nunits;
+    });
 }
 
 /*!
-  Counts number of characters in an UTF8 encoded string
+  Conversion from UTF-32 to wide character into an existing string
 
-  \param input_s UTF8-encoded string
-  \return number of characters in string
+  \param input_s UTF-32 encoded string
+  \param output  wide character string
 
-  \note Algorithm from http://canonical.org/~kragen/strlen-utf8.html
+  Each character in the input string must be a valid UTF-32 code point
+  (<= 0x10FFFF and not a surrogate) otherwise the function throws a
+  utf8::exception and `output` is not changed.
+  The previous content of `output` is replaced; its capacity is reused.
 */
-[[nodiscard]] auto length(std::string const& input_s) -> size_t {
-    size_t nc = 0;
-    auto p = input_s.begin();
-    while (p != input_s.end()) {
-        if ((*p++ & 0xC0) != 0x80) {
-            nc++;
-        }
+void widen_into(std::u32string_view input_s, std::wstring& output) {
+    size_t nunits = utf16_size(input_s.data(), input_s.size());
+    if constexpr (sizeof(wchar_t) == 4) {
+        nunits = input_s.size();
     }
-    return nc;
+    fill_string(output, nunits, [&](wchar_t* buf) {
+        utf32_to_wide(input_s.data(), input_s.size(), buf);
+        return nunits;
+    });
 }
 
 /*!
-  Counts number of characters in an UTF8 encoded string
+  Conversion from wide character to UTF-8 into a buffer
 
-  \param input_s UTF8-encoded string
-  \return number of characters in string
+  \param input_s input string
+  \param output  output buffer
+  \return size of UTF-8 string
 
-  \note Algorithm from http://canonical.org/~kragen/strlen-utf8.html
+  If the buffer is smaller than the returned size, nothing is written. Call it
+  with an empty buffer to find the size.
 */
-[[nodiscard]] auto length(const char* input_s) -> size_t {
-    size_t nc = 0;
-    while (*input_s) {
-        if ((*input_s++ & 0xC0) != 0x80) {
-            nc++;
+[[nodiscard]] auto narrow_into(std::wstring_view input_s, std::span<char> output) -> size_t {
+    if (output.size() < MAX_UTF8_PER_WIDE<wchar_t> * input_s.size()) {
+        const size_t nbytes = wide_to_utf8(input_s.data(), input_s.size(), static_cast<char*>(nullptr));
+        if (nbytes > output.size()) {
+            return nbytes;
         }
     }
-    return nc;
+    return wide_to_utf8(input_s.data(), input_s.size(), output.data());
 }
 
 /*!
-  Gets the current working directory
-  \return UTF-8 encoded name of working directory
+  Conversion from UTF-16 to UTF-8 into a buffer
+
+  \param input_s UTF-16 encoded string
+  \param output  output buffer
+  \return size of UTF-8 string
+
+  If the buffer is smaller than the returned size, nothing is written. Call it
+  with an empty buffer to find the size.
+  Unpaired surrogates are replaced by REPLACEMENT_CHARACTER (0xfffd).
 */
-[[nodiscard]] auto getcwd() -> std::string {
-    wchar_t tmp[_MAX_PATH];
-    const wchar_t* get_curent_working_dir = _wgetcwd(tmp, _countof(tmp));
-    if (get_curent_working_dir != nullptr) {
-        return narrow(tmp);
-    }
-    else {
-        return std::string();
+[[nodiscard]] auto narrow_into(std::u16string_view input_s, std::span<char> output) -> size_t {
+    if (output.size() < MAX_UTF8_PER_WIDE<char16_t> * input_s.size()) {
+        const size_t nbytes = wide_to_utf8(input_s.data(), input_s.size(), static_cast<char*>(nullptr));
+        if (nbytes > output.size()) {
+            return nbytes;
+        }
     }
+    return wide_to_utf8(input_s.data(), input_s.size(), output.data());
+}
+
+/*!
+  Conversion from UTF-32 to UTF-8 into a buffer
+
+  \param input_s UTF-32 encoded string
+  \param output  output buffer
+  \return size of UTF-8 string
+
+  If the buffer is smaller than the returned size, nothing is written. Call it
+  with an empty buffer to find the size.
+  The function throws an exception if the input contains surrogates or
+  values above 0x10FFFF.
+*/
+[[nodiscard]] auto narrow_into(std::u32string_view input_s, std::span<char> output) -> size_t {
+    const size_t nbytes = encoded_size(input_s.data(), input_s.size());
+    if (nbytes <= output.size()) {
+        utf32_to_utf8(input_s.data(), input_s.size(), output.data());
+    }
+    return nbytes;
+}
+
+/*!
+  Conversion from UTF-8 to wide character into a buffer
+
+  \param input_s UTF-8 encoded string
+  \param output  output buffer
+  \return size of wide character string
+
+  If the buffer is smaller than the returned size, nothing is written. Call it
+  with an empty buffer to find the size.
+  Invalid encodings are replaced by REPLACEMENT_CHARACTER (0xfffd).
+*/
+[[nodiscard]] auto widen_into(std::string_view input_s, std::span<wchar_t> output) -> size_t {
+    if (output.size() < input_s.size()) {
+        const size_t nch = utf8_to_wide(input_s.data(), input_s.size(), static_cast<wchar_t*>(nullptr));
+        if (nch > output.size()) {
+            return nch;
+        }
+    }
+    return utf8_to_wide(input_s.data(), input_s.size(), output.data());
+}
+
+/*!
+  Conversion from UTF-8 to UTF-16 into a buffer
+
+  \param input_s UTF-8 encoded string
+  \param output  output buffer
+  \return size of UTF-16 string
+
+  If the buffer is smaller than the returned size, nothing is written. Call it
+  with an empty buffer to find the size.
+  Invalid encodings are replaced by REPLACEMENT_CHARACTER (0xfffd).
+*/
+[[nodiscard]] auto widen_into(std::string_view input_s, std::span<char16_t> output) -> size_t {
+    if (output.size() < input_s.size()) {
+        const size_t nch = utf8_to_wide(input_s.data(), input_s.size(), static_cast<char16_t*>(nullptr));
+        if (nch > output.size()) {
+            return nch;
+        }
+    }
+    return utf8_to_wide(input_s.data(), input_s.size(), output.data());
+}
+
+/*!
+  Conversion from ISO-8859-1 (Latin-1) to UTF-8
+
+  \param input_s Latin-1 encoded string
+  \return UTF-8 encoded string
+*/
+[[nodiscard]] auto from_latin1(std::string_view input_s) -> std::string {
+    return single_byte_to_utf8(input_s, nullptr);
+}
+
+/*!
+  Conversion from Windows-1252 to UTF-8
+
+  \param input_s Windows-1252 encoded string
+  \return UTF-8 encoded string
+
+  The five byte values not defined in Windows-1252 (0x81, 0x8D, 0x8F, 0x90 and
+  0x9D) are converted to the C1 control characters with the same value, so
+  that to_cp1252() restores the original string.
+*/
+[[nodiscard]] auto from_cp1252(std::string_view input_s) -> std::string {
+    return single_byte_to_utf8(input_s, cp1252_high);
+}
+
+/*!
+  Conversion from UTF-8 to ISO-8859-1 (Latin-1)
+
+  \param input_s    UTF-8 encoded string
+  \param substitute character that replaces invalid encodings and characters
+                    above U+00FF, or `std::nullopt` to throw an exception instead
+  \return Latin-1 encoded string
+*/
+[[nodiscard]] auto to_latin1(std::string_view input_s, std::optional<char> substitute) -> std::string {
+    return utf8_to_single_byte(input_s, nullptr, substitute);
+}
+
+/*!
+  Conversion from UTF-8 to Windows-1252
+
+  \param input_s    UTF-8 encoded string
+  \param substitute character that replaces invalid encodings and characters
+                    that don't exist in Windows-1252, or `std::nullopt` to
+                    throw an exception instead
+  \return Windows-1252 encoded string
+*/
+[[nodiscard]] auto to_cp1252(std::string_view input_s, std::optional<char> substitute) -> std::string {
+    return utf8_to_single_byte(input_s, cp1252_high, substitute);
+}
+
+/*!
+  Converts a string of characters from UTF-8 to UTF-32 into a caller-supplied buffer
+
+  \param input_s UTF-8 encoded string
+  \param output  destination buffer
+  \return number of characters written and offset of first invalid encoding
+
+  The function doesn't throw. Conversion stops at the first invalid encoding or
+  when the output buffer is full; in both cases `error` is the offset of the
+  first byte that was not converted. A buffer of length(input_s) characters is
+  always large enough.
+*/
+[[nodiscard]] auto runes_into(std::string_view input_s, std::span<char32_t> output) -> runes_result {
+    const char* first = input_s.data();
+    const char* ptr = first;
+    const char* last = first + input_s.size();
+    size_t count = 0;
+
+    while (ptr < last) {
+        size_t nascii = ascii_run(ptr, static_cast<size_t>(last - ptr));
+        if (nascii != 0U) {
+            nascii = std::min(nascii, output.size() - count);
+            widen_ascii(ptr, nascii, output.data() + count);
+            ptr += nascii;
+            count += nascii;
+            if (ptr == last) {
+                break;
+            }
+        }
+
+        const char* start = ptr;
+        char32_t r;
+        if (count == output.size() || !detail::decode(ptr, last, r)) {
+            return runes_result{ count, static_cast<size_t>(start - first) };
+        }
+        output[count++] = r;
+    }
+    return runes_result{ count, runes_result::npos };
+}
+
+/*!
+  Verifies if string is a valid UTF-8 string
+
+  \param input_s pointer to character string to verify
+  \param nch number of characters to verify or 0 if string is null-terminated
+  \return `true` if string is a valid UTF-8 encoded string, `false` otherwise
+
+  Validation uses an AVX2 kernel when the processor supports it and a scalar
+  loop otherwise. The choice is made once, on first use.
+*/
+[[nodiscard]] auto valid_str(const char* input_s, size_t nch) -> bool {
+    if (nch == 0U) {
+        nch = strlen(input_s);
+    }
+    return validate_buf(input_s, nch);
+}
+
+/*!
+  Verifies if string is a valid UTF-8 string and finds the first invalid encoding
+
+  \param input_s string to verify
+  \return offset and kind of first invalid encoding
+
+  Valid strings cost the same as valid_str(). When there is an error, the
+  string is validated again in windows of 4 kB to find the window with the
+  error, and only that window is scanned byte by byte.
+*/
+[[nodiscard]] auto validate(std::string_view input_s) -> validation_result {
+    const char* first = input_s.data();
+    const char* last = first + input_s.size();
+    if (validate_buf(first, input_s.size())) {
+        return validation_result{ validation_result::none, input_s.size() };
+    }
+
+    const char* wnd = first;
+    for (;;) {
+        const char* wnd_end = last - wnd > 4096 ? wnd + 4096 : last;
+        if (wnd_end != last) {
+            // end window on a character boundary
+            const char* p = wnd_end;
+            for (int i = 0; i < 3 && (*p & 0xC0) == 0x80; i++) {
+                --p;
+            }
+            if ((*p & 0xC0) != 0x80) {
+                wnd_end = p;
+            }
+        }
+        if (!validate_buf(wnd, static_cast<size_t>(wnd_end - wnd))) {
+            break;
+        }
+        wnd = wnd_end;
+    }
+
+    uint32_t state = detail::DFA_ACCEPT;
+    const char* seq = wnd;
+    for (const char* p = wnd; p < last; p++) {
+        if (state == detail::DFA_ACCEPT) {
+            seq = p;
+        }
+        state = detail::dfa_next[state + detail::dfa_class[static_cast<uint8_t>(*p)]];
+        if (state == detail::DFA_REJECT) {
+            break;
+        }
+    }
+    return validation_result{ classify_error(seq, last), static_cast<size_t>(seq - first) };
+}
+
+/*!
+  \defgroup parallel Multi-threaded Functions
+  These functions split a large string in chunks that start on character
+  boundaries and process each chunk on a separate thread. Results are
+  identical to their single-threaded counterparts.
+
+  Strings shorter than a few hundred kilobytes per thread are processed on the
+  calling thread.
+*/
+
+/*!
+  Verifies if string is a valid UTF-8 string using multiple threads
+
+  \param input_s string to verify
+  \param nthreads maximum number of threads or 0 to use all hardware threads
+  \return offset and kind of first invalid encoding, same as validate()
+
+  Each chunk is validated independently; the reported error is the first one
+  in string order.
+*/
+[[nodiscard]] auto validate_parallel(std::string_view input_s, unsigned int nthreads) -> validation_result {
+    const std::vector<size_t> bounds = split_utf8(input_s, nthreads);
+    const size_t nchunks = bounds.size() - 1;
+    if (nchunks == 1) {
+        return validate(input_s);
+    }
+
+    std::vector<validation_result> results(nchunks);
+    run_parallel(nchunks, [&](size_t i) {
+        results[i] = validate(input_s.substr(bounds[i], bounds[i + 1] - bounds[i]));
+    });
+    for (size_t i = 0; i < nchunks; i++) {
+        if (!results[i]) {
+            return validation_result{ results[i].error, bounds[i] + results[i].offset };
+        }
+    }
+    return validation_result{ validation_result::none, input_s.size() };
+}
+
+/*!
+  Conversion from UTF-8 to UTF-32 using multiple threads
+
+  \param input_s UTF-8 encoded string
+  \param nthreads maximum number of threads or 0 to use all hardware threads
+  \return UTF-32 encoded string
+
+  Characters in each chunk are counted first, to find where its output starts,
+  and then all chunks are converted directly into the result string.
+
+  The function throws an exception if it encounters an invalid UTF-8 encoding.
+*/
+[[nodiscard]] auto runes_parallel(std::string_view input_s, unsigned int nthreads) -> std::u32string {
+    const std::vector<size_t> bounds = split_utf8(input_s, nthreads);
+    const size_t nchunks = bounds.size() - 1;
+    std::u32string str;
+    if (nchunks == 1) {
+        if (runes_into(input_s, str).error != runes_result::npos) {
+            throw exception(exception::reason::invalid_utf8);
+        }
+        return str;
+    }
+
+    std::vector<size_t> starts(nchunks + 1);
+    run_parallel(nchunks, [&](size_t i) {
+        starts[i + 1] = count_runes(input_s.data() + bounds[i], bounds[i + 1] - bounds[i]);
+    });
+    for (size_t i = 0; i < nchunks; i++) {
+        starts[i + 1] += starts[i];
+    }
+
+    // allocated here: nothing may throw inside resize_and_overwrite
+    std::vector<runes_result> results(nchunks);
+    bool failed = false;
+    fill_string(str, starts[nchunks], [&](char32_t* buf) {
+        run_parallel(nchunks, [&](size_t i) {
+            std::span<char32_t> out(buf + starts[i], starts[i + 1] - starts[i]);
+            results[i] = runes_into(input_s.substr(bounds[i], bounds[i + 1] - bounds[i]), out);
+        });
+        failed = std::any_of(results.begin(), results.end(), [](runes_result const& r) { return r.error != runes_result::npos; });
+        return failed ? size_t{ 0 } : starts[nchunks];
+    });
+    if (failed) {
+        throw exception(exception::reason::invalid_utf8);
+    }
+    return str;
+}
+
+/*!
+  Decodes a UTF-8 encoded character and advances iterator to next code point
+
+  \param ptr    Reference to iterator to be advanced
+  \param last   Iterator pointing to the end of range
+  \return       decoded character
+
+  If the string contains an invalid UTF-8 encoding, the function returns
+  REPLACEMENT_CHARACTER (0xfffd) and advances pointer to beginning of next
+  character or end of string.
+*/
+[[nodiscard]] auto next(std::string::const_iterator& ptr, const std::string::const_iterator last) -> char32_t {
+    char32_t rune;
+    if (ptr == last || !detail::decode(ptr, last, rune)) {
+        return REPLACEMENT_CHARACTER;
+    }
+    return rune;
+}
+
+/*!
+  Decodes a UTF-8 encoded character and Advances pointer to next character
+
+  \param ptr    <b>Reference</b> to character pointer to be advanced
+  \return       decoded character
+
+  If the string contains an invalid UTF-8 encoding, the function returns
+  REPLACEMENT_CHARACTER (0xfffd) and advances pointer to beginning of next
+  character or end of string.
+*/
+[[nodiscard]] auto next(const char*& ptr) -> char32_t {
+    if (*ptr == 0) {
+        return 0;
+    }
+    // The terminating null is rejected by the decoder, so there is no need for an end pointer.
+    char32_t rune;
+    return detail::decode(ptr, static_cast<const char*>(nullptr), rune) ? rune : REPLACEMENT_CHARACTER;
+}
+
+/*!
+  Decrements a character pointer to previous UTF-8 character
+
+  \param ptr    <b>Reference</b> to character pointer to be decremented
+  \return       previous UTF-8 encoded character
+
+  If the string contains an invalid UTF-8 encoding, the function returns
+  REPLACEMENT_CHARACTER (0xfffd) and pointer remains unchanged.
+*/
+[[nodiscard]] auto prev(const char*& ptr) -> char32_t {
+    char32_t rune;
+    // no lower bound: a null pointer is never reached
+    if (!decode_prev(ptr, static_cast<const char*>(nullptr), rune)) {
+        return REPLACEMENT_CHARACTER;
+    }
+    return rune;
+}
+
+/*!
+  Decrements an iterator to previous UTF-8 character
+
+  \param ptr    iterator to be decremented
+  \param first  iterator pointing to beginning of string
+  \return       previous UTF-8 encoded character
+
+  If the string contains an invalid UTF-8 encoding, the function returns
+  REPLACEMENT_CHARACTER (0xfffd) and iterator remains unchanged.
+*/
+[[nodiscard]] auto prev(std::string::const_iterator& ptr, const std::string::const_iterator first) -> char32_t {
+    char32_t rune;
+    if (ptr == first || !decode_prev(ptr, first, rune)) {
+        return REPLACEMENT_CHARACTER;
+    }
+    return rune;
+}
+
+/*!
+  Decrements a character pointer to previous UTF-8 character
+
+  \param ptr    <b>Reference</b> to character pointer to be decremented
+  \param first  pointer to beginning of string
+  \return       previous UTF-8 encoded character
+
+  If the string contains an invalid UTF-8 encoding, the function returns
+  REPLACEMENT_CHARACTER (0xfffd) and pointer remains unchanged. The function
+  never reads before `first`.
+*/
+[[nodiscard]] auto prev(const char*& ptr, const char* first) -> char32_t {
+    char32_t rune;
+    if (ptr == first || !decode_prev(ptr, first, rune)) {
+        return REPLACEMENT_CHARACTER;
+    }
+    return rune;
+}
+
+/*!
+  Moves a character pointer back a number of characters
+
+  \param ptr    <b>Reference</b> to character pointer to be moved
+  \param first  pointer to beginning of string
+  \param n      number of characters
+  \return       number of characters actually moved; less than `n` if the
+                 beginning of string was reached
+
+  Characters are counted 16 bytes at a time, without being decoded.
+*/
+auto retreat(const char*& ptr, const char* first, size_t n) -> size_t {
+    const char* p = ptr;
+    size_t moved = 0;
+#ifdef UTF8_SIMD_X64
+    // skip whole blocks of 16 bytes that don't contain the target
+    const __m128i cont_max = _mm_set1_epi8(static_cast<char>(0xBF));
+    while (moved < n && p - first >= 16) {
+        auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p - 16)), cont_max)));
+        auto cnt = static_cast<size_t>(std::popcount(mask));
+        if (moved + cnt >= n) {
+            break;
+        }
+        moved += cnt;
+        p -= 16;
+    }
+#endif
+    while (moved < n && p > first) {
+        if ((*--p & 0xC0) != 0x80) {
+            moved++;
+        }
+    }
+    ptr = p;
+    return moved;
+}
+
+/*!
+  Counts number of characters in an UTF8 encoded string
+
+  \param input_s UTF8-encoded string
+  \return number of characters in string
+
+  \note Algorithm from http://canonical.org/~kragen/strlen-utf8.html,
+  vectorized to classify 64 bytes at a time.
+*/
+[[nodiscard]] auto length(std::string const& input_s) -> size_t {
+    return count_runes(input_s.data(), input_s.size());
+}
+
+/*!
+  Counts number of characters in an UTF8 encoded string
+
+  \param input_s UTF8-encoded string
+  \return number of characters in string
+
+  Use it to size the output buffer of runes_into(); for invalid strings the
+  result is an upper bound of the number of characters that can be decoded.
+*/
+[[nodiscard]] auto length(std::string_view input_s) -> size_t {
+    return count_runes(input_s.data(), input_s.size());
+}
+
+/*!
+  \defgroup lengths Conversion Length Functions
+  Size of a converted string, computed without converting it.
+
+  Each function returns the size of the string produced by the corresponding
+  conversion function, including the replacement characters it inserts for
+  invalid input. Use them to allocate an output buffer once, up front.
+*/
+
+/*!
+  Return number of UTF-16 characters needed for an UTF-8 string
+  \param input_s UTF-8 encoded string
+  \return same as `widen16(input_s).size()`
+
+  Valid strings are counted 16 bytes at a time.
+*/
+[[nodiscard]] auto utf16_length_from_utf8(std::string_view input_s) -> size_t {
+    if (!validate_buf(input_s.data(), input_s.size())) {
+        return utf8_to_wide(input_s.data(), input_s.size(), static_cast<char16_t*>(nullptr));
+    }
+    // one character for each lead byte and one more for each 4 byte lead
+    const char* p = input_s.data();
+    const size_t nch = input_s.size();
+    size_t count = 0;
+    size_t i = 0;
+#ifdef UTF8_SIMD_X64
+    // as signed bytes, continuation bytes are in [-128, -65] and 4 byte leads in [-16, -9]
+    const __m128i cont_max = _mm_set1_epi8(static_cast<char>(0xBF));
+    const __m128i lead3_max = _mm_set1_epi8(static_cast<char>(0xEF));
+    for (; i + 16 <= nch; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        auto starts = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(bytes, cont_max)));
+        auto lead4 = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(bytes, lead3_max), bytes)));
+        count += static_cast<size_t>(std::popcount(starts) + std::popcount(lead4));
+    }
+#endif
+    for (; i < nch; i++) {
+        auto b = static_cast<uint8_t>(p[i]);
+        count += static_cast<size_t>(((b & 0xC0) != 0x80) + (b >= 0xF0));
+    }
+    return count;
+}
+
+/*!
+  Return number of UTF-32 characters needed for an UTF-8 string
+  \param input_s UTF-8 encoded string
+  \return same as `codepoints(input_s)` size; for valid strings the same as `runes(input_s).size()`
+
+  Valid strings are counted 64 bytes at a time.
+*/
+[[nodiscard]] auto utf32_length_from_utf8(std::string_view input_s) -> size_t {
+    if (!validate_buf(input_s.data(), input_s.size())) {
+        return utf8_to_wide(input_s.data(), input_s.size(), static_cast<char32_t*>(nullptr));
+    }
+    return count_runes(input_s.data(), input_s.size());
+}
+
+/*!
+  Return number of UTF-8 bytes needed for an UTF-16 string
+  \param input_s UTF-16 encoded string
+  \return same as `narrow(input_s).size()`
+
+  Blocks of 8 characters without surrogates are counted at once.
+*/
+[[nodiscard]] auto utf8_length_from_utf16(std::u16string_view input_s) -> size_t {
+    const char16_t* p = input_s.data();
+    const size_t nch = input_s.size();
+    size_t count = 0;
+    size_t i = 0;
+    while (i < nch) {
+#ifdef UTF8_SIMD_X64
+        if (i + 8 <= nch) {
+            // comparisons are signed; bias values to compare them as unsigned
+            const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            __m128i surrogates = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(static_cast<short>(0xF800))), _mm_set1_epi16(static_cast<short>(0xD800)));
+            if (_mm_movemask_epi8(surrogates) == 0) {
+                __m128i biased = _mm_xor_si128(v, bias);
+                auto m2 = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi16(biased, _mm_set1_epi16(static_cast<short>(0x7F ^ 0x8000)))));
+                auto m3 = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi16(biased, _mm_set1_epi16(static_cast<short>(0x7FF ^ 0x8000)))));
+                // each mask has 2 bits per character
+                count += 8 + static_cast<size_t>((std::popcount(m2) + std::popcount(m3)) / 2);
+                i += 8;
+                continue;
+            }
+        }
+#endif
+        for (const size_t block_end = std::min(i + 8, nch); i < block_end;) {
+            char32_t c = next_wide(p, i, nch);
+            count += static_cast<size_t>(1 + (c >= 0x80) + (c >= 0x800) + (c >= 0x10000));
+        }
+    }
+    return count;
+}
+
+/*!
+  Return number of UTF-32 characters needed for an UTF-16 string
+  \param input_s UTF-16 encoded string
+  \return same as `runes(input_s).size()`
+
+  Blocks of 8 characters without surrogates are counted at once.
+*/
+[[nodiscard]] auto utf32_length_from_utf16(std::u16string_view input_s) -> size_t {
+    const char16_t* p = input_s.data();
+    const size_t nch = input_s.size();
+    size_t count = 0;
+    size_t i = 0;
+    while (i < nch) {
+#ifdef UTF8_SIMD_X64
+        if (i + 8 <= nch) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            __m128i surrogates = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(static_cast<short>(0xF800))), _mm_set1_epi16(static_cast<short>(0xD800)));
+            if (_mm_movemask_epi8(surrogates) == 0) {
+                count += 8;
+                i += 8;
+                continue;
+            }
+        }
+#endif
+        for (const size_t block_end = std::min(i + 8, nch); i < block_end; count++) {
+            (void)next_wide(p, i, nch);
+        }
+    }
+    return count;
+}
+
+/*!
+  Return number of UTF-8 bytes needed for an UTF-32 string
+  \param input_s UTF-32 encoded string
+  \return same as `narrow(input_s).size()`
+
+  Like narrow(), the function throws a utf8::exception if the string contains
+  invalid code points.
+*/
+[[nodiscard]] auto utf8_length_from_utf32(std::u32string_view input_s) -> size_t {
+    return encoded_size(input_s.data(), input_s.size());
+}
+
+/*!
+  Return number of UTF-16 characters needed for an UTF-32 string
+  \param input_s UTF-32 encoded string
+  \return same as `widen16(input_s).size()`
+
+  Like widen16(), the function throws a utf8::exception if the string contains
+  invalid code points.
+*/
+[[nodiscard]] auto utf16_length_from_utf32(std::u32string_view input_s) -> size_t {
+    return utf16_size(input_s.data(), input_s.size());
+}
+
+/*!
+  Return number of UTF-8 bytes needed for a Latin-1 string
+  \param input_s ISO-8859-1 encoded string
+  \return same as `from_latin1(input_s).size()`
+*/
+[[nodiscard]] auto utf8_length_from_latin1(std::string_view input_s) -> size_t {
+    return single_byte_utf8_size(input_s, nullptr);
+}
+
+/*!
+  Return number of UTF-8 bytes needed for a Windows-1252 string
+  \param input_s Windows-1252 encoded string
+  \return same as `from_cp1252(input_s).size()`
+*/
+[[nodiscard]] auto utf8_length_from_cp1252(std::string_view input_s) -> size_t {
+    return single_byte_utf8_size(input_s, cp1252_high);
+}
+
+/*!
+  Counts number of characters in an UTF8 encoded string
+
+  \param input_s UTF8-encoded string
+  \return number of characters in string
+
+  \note Algorithm from http://canonical.org/~kragen/strlen-utf8.html
+  The search for the terminating null is done in the same pass as counting.
+
+  On x64 the bytes up to the first 16-byte boundary are counted one at a
+  time; after that the string is read in aligned 16-byte blocks, stopping at
+  the block that holds the terminating null. That last block may extend past
+  the end of the string. An aligned load never crosses a page boundary so
+  this cannot fault, but AddressSanitizer would report it, which is why the
+  function is excluded from address sanitizing.
+*/
+#ifdef UTF8_SIMD_X64
+UTF8_NO_SANITIZE_ADDRESS
+#endif
+[[nodiscard]] auto length(const char* input_s) -> size_t {
+    size_t nc = 0;
+#ifdef UTF8_SIMD_X64
+    while ((reinterpret_cast<uintptr_t>(input_s) & 15) != 0) {
+        if (*input_s == 0) {
+            return nc;
+        }
+        if ((*input_s++ & 0xC0) != 0x80) {
+            nc++;
+        }
+    }
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i cont_max = _mm_set1_epi8(static_cast<char>(0xBF));
+    for (const auto* block = reinterpret_cast<const __m128i*>(input_s);; ++block) {
+        __m128i bytes = _mm_load_si128(block);
+        auto nulls = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, zero)));
+        auto leads = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(bytes, cont_max)));
+        if (nulls != 0) {
+            return nc + static_cast<size_t>(std::popcount(leads & ((nulls & (0U - nulls)) - 1)));
+        }
+        nc += static_cast<size_t>(std::popcount(leads));
+    }
+#else
+    while (*input_s) {
+        if ((*input_s++ & 0xC0) != 0x80) {
+            nc++;
+        }
+    }
+    return nc;
+#endif
+}
+
+/*!
+  Gets the current working directory
+  \return UTF-8 encoded name of working directory
+*/
+[[nodiscard]] auto getcwd() -> std::string {
+    wchar_t tmp[_MAX_PATH];
+    const wchar_t* get_curent_working_dir = _wgetcwd(tmp, _countof(tmp));
+    if (get_curent_working_dir != nullptr) {
+        return narrow(tmp);
+    }
+    else {
+        return std::string();
+    }
+}
+
+/*!
+  Breaks a path name into components
+
+  \param path   UTF-8 encoded full path
+  \param drive  drive letter followed by colon (or NULL if not needed)
+  \param dir    directory path (or NULL if not needed)
+  \param fname  base filename (or NULL if not needed)
+  \param ext    file extension including the leading period (.)
+                (or NULL if not needed)
+  \return       true if successful, false otherwise
+  Returned strings are converted to UTF-8.
+*/
+[[nodiscard]] auto splitpath(std::string const& path, char* drive, char* dir, char* fname, char* ext) -> bool {
+    std::wstring wpath = widen(path);
+    wchar_t wdrive[_MAX_DRIVE];
+    wchar_t wdir[_MAX_DIR];
+    wchar_t wfname[_MAX_FNAME];
+    wchar_t wext[_MAX_EXT];
+    const auto split_path_safe = _wsplitpath_s(wpath.c_str(), wdrive, wdir, wfname, wext);
+    if (split_path_safe != 0) {
+        return false;
+    }
+
+    if (drive != nullptr) {
+        strncpy_s(drive, _MAX_DRIVE, narrow(wdrive).c_str(), _MAX_DRIVE - 1);
+    }
+    if (dir != nullptr) {
+        strncpy_s(dir, _MAX_DIR, narrow(wdir).c_str(), _MAX_DIR - 1);
+    }
+    if (fname != nullptr) {
+        strncpy_s(fname, _MAX_FNAME, narrow(wfname).c_str(), _MAX_FNAME - 1);
+    }
+    if (ext != nullptr) {
+        strncpy_s(ext, _MAX_EXT, narrow(wext).c_str(), _MAX_EXT - 1);
+    }
+
+    return true;
 }
 
 /*!
   Breaks a path name into components
 
-  \param path   UTF-8 encoded full path
-  \param drive  drive letter followed by colon (or NULL if not needed)
-  \param dir    directory path (or NULL if not needed)
-  \param fname  base filename (or NULL if not needed)
-  \param ext    file extension including the leading period (.)
-                (or NULL if not needed)
-  \return       true if successful, false otherwise
-  Returned strings are converted to UTF-8.
+  \param path   UTF-8 encoded full path
+  \param drive  drive letter followed by colon
+  \param dir    directory path
+  \param fname  base filename
+  \param ext    file extension including the leading period (.)
+
+  Returned strings are converted to UTF-8.
+*/
+[[nodiscard]] auto splitpath(std::string const& path, std::string& drive, std::string& dir, std::string& fname, std::string& ext) -> bool {
+    std::wstring wpath = widen(path);
+    wchar_t wdrive[_MAX_DRIVE];
+    wchar_t wdir[_MAX_DIR];
+    wchar_t wfname[_MAX_FNAME];
+    wchar_t wext[_MAX_EXT];
+
+    const auto split_path_safe = _wsplitpath_s(wpath.c_str(), wdrive, wdir, wfname, wext);
+    if (split_path_safe != 0) {
+        return false;
+    }
+
+    drive = narrow(wdrive);
+    dir = narrow(wdir);
+    fname = narrow(wfname);
+    ext = narrow(wext);
+    return true;
+}
+
+/*!
+  Creates a path from UTF-8 encoded components.
+
+  \param path   Resulting path (UTF-8 encoded)
+  \param drive  drive letter
+  \param dir    directory path
+  \param fname  filename
+  \param ext    extension
+  \return       True if successful; false otherwise
+
+  If any required syntactic element (colon after drive letter, '\' at end of
+  directory path, colon before extension) is missing, it is automatically added.
+*/
+[[nodiscard]] auto makepath(std::string& path, std::string const& drive, std::string const& dir, std::string const& fname, std::string const& ext) -> bool {
+    wchar_t wpath[_MAX_PATH];
+    const auto make_path_safe = _wmakepath_s(wpath, widen(drive).c_str(), widen(dir).c_str(), widen(fname).c_str(), widen(ext).c_str());
+    if (make_path_safe != 0) {
+        return false;
+    }
+
+    path = narrow(wpath);
+    return true;
+}
+
+/*!
+  Returns the absolute (full) path of a filename
+  \param relpath relative path
+*/
+[[nodiscard]] auto fullpath(std::string const& relpath) -> std::string {
+    wchar_t wpath[_MAX_PATH];
+    const wchar_t* full_path = _wfullpath(wpath, widen(relpath).c_str(), _MAX_PATH);
+    if (full_path != nullptr) {
+        return narrow(wpath);
+    }
+    return std::string();
+}
+
+/*!
+  Retrieves the value of an environment variable
+  \param  var name of environment variable
+  \return value of environment variable or an empty string if there is no such
+          environment variable
+*/
+[[nodiscard]] auto getenv(std::string const& var) -> std::string {
+    size_t nsz{};
+    std::wstring wvar = widen(var);
+    _wgetenv_s(&nsz, 0, 0, wvar.c_str());
+    if (nsz == 0U) {
+        return std::string();
+    }
+
+    std::wstring wval(nsz, L'\0');
+    _wgetenv_s(&nsz, wval.data(), nsz, wvar.c_str());
+    wval.resize(nsz - 1);
+    return narrow(wval);
+}
+
+/*!
+  Converts wide byte command arguments to an array of pointers
+  to UTF-8 strings.
+
+  \param  argc Pointer to an integer that contains number of parameters
+  \return array of pointers to each command line parameter or NULL if an error
+  occurred.
+
+  The space allocated for strings and array of pointers should be freed
+  by calling free_utf8argv()
+*/
+[[nodiscard]] auto get_argv(int* argc) -> char** {
+    char** uargv = nullptr;
+    wchar_t** wargv = CommandLineToArgvW(GetCommandLineW(), argc);
+    if (wargv != nullptr) {
+        uargv = new char*[static_cast<size_t>(*argc)];
+        for (int32_t i = 0; i < *argc; i++) {
+            size_t wlen = wcslen(wargv[i]);
+            uargv[i] = new char[MAX_UTF8_PER_WIDE<wchar_t> * wlen + 1];
+            uargv[i][wide_to_utf8(wargv[i], wlen, uargv[i])] = 0;
+        }
+        LocalFree(wargv);
+    }
+    return uargv;
+}
+
+/*!
+  Frees the memory allocated by get_argv(int *argc)
+
+  \param  argc  number of arguments
+  \param  argv  array of pointers to arguments
+*/
+void free_argv(int32_t argc, char** argv) {
+    for (int32_t i = 0; i < argc; i++) {
+        delete[] argv[i];
+    }
+    delete[] argv;
+}
+
+/*!
+  Converts wide byte command arguments to UTF-8 to a vector of UTF-8 strings.
+
+  \return vector of UTF-8 strings. The vector is empty if an error occurred.
+*/
+[[nodiscard]] auto get_argv() -> std::vector<std::string> {
+    int32_t argc{};
+    std::vector<std::string> uargv;
+
+    wchar_t** wargv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    if (wargv != nullptr) {
+        for (int32_t i = 0; i < argc; i++) {
+            uargv.push_back(narrow(wargv[i]));
+        }
+        LocalFree(wargv);
+    }
+    return uargv;
+}
+
+/*!
+  \defgroup charclass Character Classification Functions
+  Replacements for character classification functions.
+
+  According to C standard, the [is...](https://en.cppreference.com/w/cpp/header/cctype)
+  family of functions have undefined behavior if the argument is outside the
+  range of printable characters. These replacement functions are well-behaved
+  for any input string.
+
+  The argument is a character pointer or a string iterator. Use them as in the
+  following example:
+\code
+  //skip spaces in UTF-8 string
+  string s{ u8" \xA0日本語" };
+  auto p = s.begin ();
+  int blanks = 0;
+  while (p != s.end () && utf8::isspace (p))
+  {
+    blanks++;
+    utf8::next (p, s.end ());
+  }
+  assert (blanks == 2); //both space and "no-break space" are space characters
+  //...
+\endcode
+
+*/
+
+/*!
+  Return true if character is blank(-ish).
+  \param p_check pointer to character to check
+  \return `true` if character is blank, `false` otherwise
+
+  Returns `true` if Unicode character has the "White_Space=yes" property in the
+  [Unicode Character Database](https://www.unicode.org/Public/UCD/latest/ucd/PropList.txt)
+*/
+[[nodiscard]] auto isspace(const char* p_check) -> bool {
+    const char32_t spacetab[]{ 0x20,   0x09,   0x0d,   0x0a,   0x0b,   0x0c,   0x85,   0xA0,   0x1680, 0x2000, 0x2001, 0x2002,
+                               0x2004, 0x2005, 0x2006, 0x2007, 0x2008, 0x2009, 0x200A, 0x2028, 0x2020, 0x202f, 0x205f, 0x3000 };
+
+    char32_t c = rune(p_check);
+    for (size_t i = 0; i < std::size(spacetab); i++) {
+        if (c == spacetab[i]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// ----------------------- Low level internal functions -----------------------
+
+/*!
+  Return size of UTF-8 encoding of a UTF-32 string
+  \param input_s UTF-32 encoded string
+  \param nch     number of characters
+
+  Throws a utf8::exception if the string contains surrogates or values
+  above 0x10FFFF.
+*/
+static auto encoded_size(const char32_t* input_s, size_t nch) -> size_t {
+    size_t nbytes = nch;
+    bool invalid = false;
+    size_t i = 0;
+#ifdef UTF8_SIMD_X64
+    // comparisons are signed; values above 0x7FFFFFFF are negative
+    const __m128i max_1 = _mm_set1_epi32(0x7F);
+    const __m128i max_2 = _mm_set1_epi32(0x7FF);
+    const __m128i max_3 = _mm_set1_epi32(0xFFFF);
+    const __m128i max_rune = _mm_set1_epi32(0x10FFFF);
+    const __m128i surrogate_mask = _mm_set1_epi32(static_cast<int>(0xFFFFF800));
+    const __m128i surrogate = _mm_set1_epi32(0xD800);
+    __m128i bad = _mm_setzero_si128();
+    for (; i + 4 <= nch; i += 4) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i));
+        auto m1 = static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(c, max_1))));
+        auto m2 = static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(c, max_2))));
+        auto m3 = static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(c, max_3))));
+        nbytes += static_cast<size_t>(std::popcount(m1 | m2 << 4 | m3 << 8));
+        bad = _mm_or_si128(bad, _mm_or_si128(_mm_cmpgt_epi32(c, max_rune), _mm_cmplt_epi32(c, _mm_setzero_si128())));
+        bad = _mm_or_si128(bad, _mm_cmpeq_epi32(_mm_and_si128(c, surrogate_mask), surrogate));
+    }
+    invalid = _mm_movemask_epi8(bad) != 0;
+#endif
+    for (; i < nch; i++) {
+        char32_t c = input_s[i];
+        nbytes += static_cast<size_t>((c >= 0x80) + (c >= 0x800) + (c >= 0x10000));
+        invalid |= c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF);
+    }
+    if (invalid) {
+        throw exception(exception::reason::invalid_char32);
+    }
+    return nbytes;
+}
+
+/*!
+  Conversion from valid UTF-32 to UTF-8
+  \param input_s UTF-32 encoded string
+  \param nch     number of characters
+  \param out     output buffer of encoded_size() bytes
+
+  Runs of ASCII characters are converted 8 at a time.
+*/
+static void utf32_to_utf8(const char32_t* input_s, size_t nch, char* out) {
+    size_t i = 0;
+#ifdef UTF8_SIMD_X64
+    // input is valid here so there are no negative values
+    const __m128i ascii_max = _mm_set1_epi32(0x7F);
+    while (i + 8 <= nch) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i + 4));
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi32(lo, ascii_max), _mm_cmpgt_epi32(hi, ascii_max))) != 0) {
+            for (const size_t end = i + 8; i < end; i++) {
+                out = detail::encode(input_s[i], out);
+            }
+            continue;
+        }
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(lo, hi), _mm_setzero_si128());
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out), bytes);
+        out += 8;
+        i += 8;
+    }
+#endif
+    for (; i < nch; i++) {
+        out = detail::encode(input_s[i], out);
+    }
+}
+
+/// Scalar validation using the decoding automaton
+static auto validate_scalar(const char* input_s, size_t nch) -> bool {
+    const auto* p = reinterpret_cast<const uint8_t*>(input_s);
+    uint32_t state = detail::DFA_ACCEPT;
+    size_t i = 0;
+    while (i < nch) {
+        // the reject state is absorbing, so it is enough to check it once per block
+        size_t blk = std::min(nch, i + 64);
+        for (; i < blk; i++) {
+            state = detail::dfa_next[state + detail::dfa_class[p[i]]];
+        }
+        if (state == detail::DFA_REJECT) {
+            return false;
+        }
+    }
+    return state == detail::DFA_ACCEPT;
+}
+
+#ifdef UTF8_SIMD_X64
+/// Return `true` if processor and operating system support AVX2 instructions
+static auto cpu_has_avx2() -> bool {
+#ifdef _MSC_VER
+    int32_t regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7) {
+        return false;
+    }
+    __cpuid(regs, 1);
+    if ((regs[2] & (1 << 27)) == 0 || (regs[2] & (1 << 28)) == 0) {
+        return false; // no OSXSAVE or no AVX
+    }
+    if ((_xgetbv(0) & 6) != 6) {
+        return false; // OS doesn't save YMM registers
+    }
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#else
+    uint32_t eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0, nullptr) < 7) {
+        return false;
+    }
+    __cpuid(1, eax, ebx, ecx, edx);
+    if ((ecx & (1U << 27)) == 0 || (ecx & (1U << 28)) == 0) {
+        return false; // no OSXSAVE or no AVX
+    }
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 6) != 6) {
+        return false; // OS doesn't save YMM registers
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1U << 5)) != 0;
+#endif
+}
+
+/*!
+  AVX2 validation using the lookup algorithm from
+  J. Keiser, D. Lemire "Validating UTF-8 In Less Than One Instruction Per Byte"
+  (https://arxiv.org/abs/2010.03090)
+
+  Each byte is classified by three 16-entry tables indexed by the high nibble of
+  the previous byte, the low nibble of the previous byte and the high nibble of
+  the current byte. The AND of the three classifications is non-zero only for
+  invalid 2-byte sequences. Third and fourth bytes of longer sequences are
+  checked separately.
+*/
+UTF8_TARGET_AVX2 static auto validate_avx2(const char* input_s, size_t nch) -> bool {
+    constexpr char TOO_SHORT = 1 << 0; // 11______ 0_______ or 11______ 11______
+    constexpr char TOO_LONG = 1 << 1; // 0_______ 10______
+    constexpr char OVERLONG_3 = 1 << 2; // 11100000 100_____
+    constexpr char TOO_LARGE = 1 << 3; // 11110100 1001____ or 11110100 101_____
+    constexpr char SURROGATE = 1 << 4; // 11101101 101_____
+    constexpr char OVERLONG_2 = 1 << 5; // 1100000_ 10______
+    constexpr char TOO_LARGE_1000 = 1 << 6; // 11110101+ 1000____
+    constexpr char OVERLONG_4 = 1 << 6; // 11110000 1000____
+    constexpr char TWO_CONTS = static_cast<char>(1 << 7); // 10______ 10______
+    constexpr char CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+    const __m256i byte_1_high_tab = _mm256_setr_epi8(
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, TOO_SHORT | OVERLONG_2, TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE, TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, TOO_SHORT | OVERLONG_2, TOO_SHORT, TOO_SHORT | OVERLONG_3 | SURROGATE, TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+    const __m256i byte_1_low_tab = _mm256_setr_epi8(
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2, CARRY, CARRY, CARRY | TOO_LARGE, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2, CARRY, CARRY,
+        CARRY | TOO_LARGE, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000);
+    const __m256i byte_2_high_tab = _mm256_setr_epi8(
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4, TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4, TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+    // last three bytes of a block must not start a sequence that continues past the block
+    const __m256i max_incomplete = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                    static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+
+    __m256i error = _mm256_setzero_si256();
+    __m256i prev_input = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+
+    auto check_block = [&](__m256i input) UTF8_TARGET_AVX2 {
+        if (_mm256_movemask_epi8(input) == 0) {
+            // all ASCII; only an unfinished sequence from previous block can be an error
+            error = _mm256_or_si256(error, prev_incomplete);
+            prev_incomplete = _mm256_setzero_si256();
+            prev_input = input;
+            return;
+        }
+
+        __m256i shifted = _mm256_permute2x128_si256(prev_input, input, 0x21);
+        __m256i prev1 = _mm256_alignr_epi8(input, shifted, 16 - 1);
+        __m256i prev2 = _mm256_alignr_epi8(input, shifted, 16 - 2);
+        __m256i prev3 = _mm256_alignr_epi8(input, shifted, 16 - 3);
+
+        __m256i byte_1_high = _mm256_shuffle_epi8(byte_1_high_tab, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble_mask));
+        __m256i byte_1_low = _mm256_shuffle_epi8(byte_1_low_tab, _mm256_and_si256(prev1, nibble_mask));
+        __m256i byte_2_high = _mm256_shuffle_epi8(byte_2_high_tab, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble_mask));
+        __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+        // only 111_____ bytes two positions back and 1111____ bytes three positions back require a continuation byte
+        __m256i third_byte = _mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+        __m256i fourth_byte = _mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+        __m256i must23_80 = _mm256_and_si256(_mm256_or_si256(third_byte, fourth_byte), _mm256_set1_epi8(static_cast<char>(0x80)));
+
+        error = _mm256_or_si256(error, _mm256_xor_si256(must23_80, special));
+        prev_incomplete = _mm256_subs_epu8(input, max_incomplete);
+        prev_input = input;
+    };
+
+    size_t i = 0;
+    for (; i + 32 <= nch; i += 32) {
+        check_block(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(input_s + i)));
+    }
+    if (i < nch) {
+        // pad tail with ASCII zeros
+        alignas(32) char tail[32]{};
+        memcpy(tail, input_s + i, nch - i);
+        check_block(_mm256_load_si256(reinterpret_cast<const __m256i*>(tail)));
+    }
+    error = _mm256_or_si256(error, prev_incomplete);
+    return _mm256_testz_si256(error, error) != 0;
+}
+#endif
+
+/// Return number of ASCII characters at the beginning of a buffer
+static auto ascii_run(const char* input_s, size_t nch) -> size_t {
+    size_t i = 0;
+#ifdef UTF8_SIMD_X64
+    for (; i + 32 <= nch; i += 32) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i + 16));
+        if (_mm_movemask_epi8(_mm_or_si128(lo, hi)) != 0) {
+            break;
+        }
+    }
+    for (; i + 16 <= nch; i += 16) {
+        auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i))));
+        if (mask != 0) {
+            return i + static_cast<size_t>(std::countr_zero(mask));
+        }
+    }
+#endif
+    for (; i + 8 <= nch; i += 8) {
+        uint64_t word;
+        memcpy(&word, input_s + i, sizeof(word));
+        word &= 0x8080808080808080ULL;
+        if (word != 0) {
+            return i + static_cast<size_t>(std::countr_zero(word) / 8);
+        }
+    }
+    while (i < nch && (input_s[i] & 0x80) == 0) {
+        i++;
+    }
+    return i;
+}
+
+/*!
+  Change case of the ASCII characters at the beginning of a buffer
+  \param input_s input string
+  \param nch     number of bytes
+  \param out     output buffer of `nch` bytes; can be the same as `input_s`
+  \param upper   `true` to convert to upper case, `false` to lower case
+  \return number of characters converted; conversion stops at the first non-ASCII byte
+
+  Blocks of 32 characters are converted at once: letters are found with two
+  signed comparisons and their case bit (0x20) is flipped.
 */
-[[nodiscard]] auto splitpath(std::string const& path, char* drive, char* dir, char* fname, char* ext) -> bool {
-    std::wstring wpath = widen(path);
-    wchar_t wdrive[_MAX_DRIVE];
-    wchar_t wdir[_MAX_DIR];
-    wchar_t wfname[_MAX_FNAME];
-    wchar_t wext[_MAX_EXT];
-    const auto split_path_safe = _wsplitpath_s(wpath.c_str(), wdrive, wdir, wfname, wext);
-    if (split_path_safe != 0) {
-        return false;
+static auto ascii_case(const char* input_s, size_t nch, char* out, bool upper) -> size_t {
+    const char first = upper ? 'a' : 'A';
+    const char last = upper ? 'z' : 'Z';
+    size_t i = 0;
+#ifdef UTF8_SIMD_X64
+    const __m128i before_first = _mm_set1_epi8(static_cast<char>(first - 1));
+    const __m128i after_last = _mm_set1_epi8(static_cast<char>(last + 1));
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    auto convert = [&](__m128i v) {
+        __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(v, before_first), _mm_cmplt_epi8(v, after_last));
+        return _mm_xor_si128(v, _mm_and_si128(letters, case_bit));
+    };
+    for (; i + 32 <= nch; i += 32) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i + 16));
+        if (_mm_movemask_epi8(_mm_or_si128(lo, hi)) != 0) {
+            break;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), convert(lo));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 16), convert(hi));
+    }
+    if (i + 16 <= nch) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i));
+        if (_mm_movemask_epi8(v) == 0) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), convert(v));
+            i += 16;
+        }
+    }
+#endif
+    for (; i < nch && (input_s[i] & 0x80) == 0; i++) {
+        char c = input_s[i];
+        out[i] = (c >= first && c <= last) ? static_cast<char>(c ^ 0x20) : c;
     }
+    return i;
+}
 
-    if (drive != nullptr) {
-        strncpy_s(drive, _MAX_DRIVE, narrow(wdrive).c_str(), _MAX_DRIVE - 1);
+/// Widen a run of ASCII characters to UTF-16 or UTF-32, depending on size of `C`
+template <typename C>
+static void widen_ascii(const char* input_s, size_t nch, C* out) {
+    size_t i = 0;
+#ifdef UTF8_SIMD_X64
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= nch; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i));
+        __m128i lo16 = _mm_unpacklo_epi8(bytes, zero);
+        __m128i hi16 = _mm_unpackhi_epi8(bytes, zero);
+        if constexpr (sizeof(C) == 2) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), lo16);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), hi16);
+        }
+        else {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi16(lo16, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 4), _mm_unpackhi_epi16(lo16, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_unpacklo_epi16(hi16, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 12), _mm_unpackhi_epi16(hi16, zero));
+        }
     }
-    if (dir != nullptr) {
-        strncpy_s(dir, _MAX_DIR, narrow(wdir).c_str(), _MAX_DIR - 1);
+#endif
+    for (; i < nch; i++) {
+        out[i] = static_cast<C>(input_s[i]);
     }
-    if (fname != nullptr) {
-        strncpy_s(fname, _MAX_FNAME, narrow(wfname).c_str(), _MAX_FNAME - 1);
+}
+
+/*!
+  Conversion from UTF-8 to UTF-16 or UTF-32, depending on size of `C`
+  \param input_s UTF-8 encoded string
+  \param nch     number of bytes
+  \param out     output buffer or `nullptr` to only count output characters
+  \return number of output characters
+
+  Invalid encodings are replaced by REPLACEMENT_CHARACTER (0xfffd).
+*/
+template <typename C>
+static auto utf8_to_wide(const char* input_s, size_t nch, C* out) -> size_t {
+    const char* ptr = input_s;
+    const char* last = input_s + nch;
+    size_t count = 0;
+    while (ptr < last) {
+        size_t nascii = ascii_run(ptr, static_cast<size_t>(last - ptr));
+        if (out != nullptr) {
+            widen_ascii(ptr, nascii, out + count);
+        }
+        ptr += nascii;
+        count += nascii;
+        if (ptr == last) {
+            break;
+        }
+
+        char32_t r;
+        detail::decode(ptr, last, r); // r is REPLACEMENT_CHARACTER if invalid
+        if (sizeof(C) == 2 && r >= 0x10000) {
+            if (out != nullptr) {
+                encode_utf16(r, out + count);
+            }
+            count += 2;
+        }
+        else {
+            if (out != nullptr) {
+                out[count] = static_cast<C>(r);
+            }
+            count++;
+        }
     }
-    if (ext != nullptr) {
-        strncpy_s(ext, _MAX_EXT, narrow(wext).c_str(), _MAX_EXT - 1);
+    return count;
+}
+
+/*!
+  Conversion from UTF-16 or UTF-32, depending on size of `C`, to UTF-8
+  \param input_s input string
+  \param nch     number of input characters
+  \param out     output buffer or `nullptr` to only count output bytes
+  \return number of output bytes
+
+  Unpaired surrogates and values above 0x10FFFF are replaced by
+  REPLACEMENT_CHARACTER (0xfffd). Blocks of 8 ASCII characters are narrowed
+  at once.
+*/
+template <typename C>
+static auto wide_to_utf8(const C* input_s, size_t nch, char* out) -> size_t {
+    size_t count = 0;
+    size_t i = 0;
+    while (i < nch) {
+#ifdef UTF8_SIMD_X64
+        if (i + 8 <= nch) {
+            __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i));
+            __m128i bytes;
+            bool ascii;
+            if constexpr (sizeof(C) == 2) {
+                __m128i high_bits = _mm_and_si128(lo, _mm_set1_epi16(static_cast<short>(0xFF80)));
+                ascii = _mm_movemask_epi8(_mm_cmpeq_epi16(high_bits, _mm_setzero_si128())) == 0xFFFF;
+                bytes = _mm_packus_epi16(lo, lo);
+            }
+            else {
+                __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i + 4));
+                __m128i high_bits = _mm_and_si128(_mm_or_si128(lo, hi), _mm_set1_epi32(static_cast<int>(0xFFFFFF80)));
+                ascii = _mm_movemask_epi8(_mm_cmpeq_epi32(high_bits, _mm_setzero_si128())) == 0xFFFF;
+                __m128i words = _mm_packs_epi32(lo, hi);
+                bytes = _mm_packus_epi16(words, words);
+            }
+            if (ascii) {
+                if (out != nullptr) {
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + count), bytes);
+                }
+                i += 8;
+                count += 8;
+                continue;
+            }
+        }
+#endif
+        // convert up to 8 characters one by one
+        for (const size_t block_end = std::min(i + 8, nch); i < block_end;) {
+            char32_t c = next_wide(input_s, i, nch);
+            if (out != nullptr) {
+                detail::encode(c, out + count);
+            }
+            count += static_cast<size_t>(1 + (c >= 0x80) + (c >= 0x800) + (c >= 0x10000));
+        }
     }
+    return count;
+}
 
-    return true;
+/*!
+  Decode one UTF-16 (2 byte `C`) or UTF-32 (4 byte `C`) character
+  \param input_s input string
+  \param i       index of character; advanced past it
+  \param nch     number of input characters
+  \return decoded character or REPLACEMENT_CHARACTER (0xfffd) for unpaired
+           surrogates and values above 0x10FFFF
+*/
+template <typename C>
+static auto next_wide(const C* input_s, size_t& i, size_t nch) -> char32_t {
+    auto c = static_cast<char32_t>(input_s[i++]);
+    if constexpr (sizeof(C) == 2) {
+        c &= 0xFFFF;
+        if (c >= 0xD800 && c <= 0xDBFF && i < nch && (input_s[i] & 0xFC00) == 0xDC00) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (static_cast<char32_t>(input_s[i++]) - 0xDC00);
+        }
+    }
+    if ((c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF) {
+        c = REPLACEMENT_CHARACTER;
+    }
+    return c;
 }
 
 /*!
-  Breaks a path name into components
+  Conversion from UTF-16 (2 byte `C`) or UTF-32 (4 byte `C`) to UTF-32
+  \param input_s input string
+  \param nch     number of input characters
+  \param out     output buffer of at least `nch` characters
+  \return number of output characters
+
+  Unpaired surrogates and values above 0x10FFFF are replaced by
+  REPLACEMENT_CHARACTER (0xfffd). Blocks of 8 UTF-16 characters without
+  surrogates are widened at once.
+*/
+template <typename C>
+static auto wide_to_utf32(const C* input_s, size_t nch, char32_t* out) -> size_t {
+    size_t count = 0;
+    size_t i = 0;
+    while (i < nch) {
+#ifdef UTF8_SIMD_X64
+        if constexpr (sizeof(C) == 2) {
+            if (i + 8 <= nch) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i));
+                __m128i surrogates = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(static_cast<short>(0xF800))), _mm_set1_epi16(static_cast<short>(0xD800)));
+                if (_mm_movemask_epi8(surrogates) == 0) {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + count), _mm_unpacklo_epi16(v, _mm_setzero_si128()));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + count + 4), _mm_unpackhi_epi16(v, _mm_setzero_si128()));
+                    i += 8;
+                    count += 8;
+                    continue;
+                }
+            }
+        }
+#endif
+        for (const size_t block_end = std::min(i + 8, nch); i < block_end;) {
+            out[count++] = next_wide(input_s, i, nch);
+        }
+    }
+    return count;
+}
 
-  \param path   UTF-8 encoded full path
-  \param drive  drive letter followed by colon
-  \param dir    directory path
-  \param fname  base filename
-  \param ext    file extension including the leading period (.)
+/*!
+  Return size of UTF-16 encoding of a UTF-32 string
+  \param input_s UTF-32 encoded string
+  \param nch     number of characters
 
-  Returned strings are converted to UTF-8.
+  Throws a utf8::exception if the string contains surrogates or values
+  above 0x10FFFF.
 */
-[[nodiscard]] auto splitpath(std::string const& path, std::string& drive, std::string& dir, std::string& fname, std::string& ext) -> bool {
-    std::wstring wpath = widen(path);
-    wchar_t wdrive[_MAX_DRIVE];
-    wchar_t wdir[_MAX_DIR];
-    wchar_t wfname[_MAX_FNAME];
-    wchar_t wext[_MAX_EXT];
+static auto utf16_size(const char32_t* input_s, size_t nch) -> size_t {
+    size_t nunits = nch;
+    bool invalid = false;
+    size_t i = 0;
+#ifdef UTF8_SIMD_X64
+    // comparisons are signed; values above 0x7FFFFFFF are negative
+    const __m128i max_bmp = _mm_set1_epi32(0xFFFF);
+    const __m128i max_rune = _mm_set1_epi32(0x10FFFF);
+    const __m128i surrogate_mask = _mm_set1_epi32(static_cast<int>(0xFFFFF800));
+    const __m128i surrogate = _mm_set1_epi32(0xD800);
+    __m128i bad = _mm_setzero_si128();
+    for (; i + 4 <= nch; i += 4) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i));
+        nunits += static_cast<size_t>(std::popcount(static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(c, max_bmp))))));
+        bad = _mm_or_si128(bad, _mm_or_si128(_mm_cmpgt_epi32(c, max_rune), _mm_cmplt_epi32(c, _mm_setzero_si128())));
+        bad = _mm_or_si128(bad, _mm_cmpeq_epi32(_mm_and_si128(c, surrogate_mask), surrogate));
+    }
+    invalid = _mm_movemask_epi8(bad) != 0;
+#endif
+    for (; i < nch; i++) {
+        char32_t c = input_s[i];
+        nunits += static_cast<size_t>(c >= 0x10000);
+        invalid |= c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF);
+    }
+    if (invalid) {
+        throw exception(exception::reason::invalid_char32);
+    }
+    return nunits;
+}
 
-    const auto split_path_safe = _wsplitpath_s(wpath.c_str(), wdrive, wdir, wfname, wext);
-    if (split_path_safe != 0) {
-        return false;
+/// Encode a valid character as UTF-16 and return pointer past its encoding
+template <typename C>
+static auto encode_utf16(char32_t input_char, C* output) -> C* {
+    if (input_char >= 0x10000) {
+        *output++ = static_cast<C>(0xD800 + ((input_char - 0x10000) >> 10));
+        *output++ = static_cast<C>(0xDC00 + (input_char & 0x3FF));
+    }
+    else {
+        *output++ = static_cast<C>(input_char);
     }
+    return output;
+}
 
-    drive = narrow(wdrive);
-    dir = narrow(wdir);
-    fname = narrow(wfname);
-    ext = narrow(wext);
-    return true;
+/*!
+  Conversion from valid UTF-32 to UTF-16 (2 byte `C`) or UTF-32 (4 byte `C`)
+  \param input_s UTF-32 encoded string
+  \param nch     number of characters
+  \param out     output buffer of utf16_size() characters (`nch` if `C` is 4 bytes)
+
+  Blocks of 8 characters from the Basic Multilingual Plane are narrowed at once.
+*/
+template <typename C>
+static void utf32_to_wide(const char32_t* input_s, size_t nch, C* out) {
+    if constexpr (sizeof(C) == 4) {
+        std::copy(input_s, input_s + nch, out);
+    }
+    else {
+        size_t i = 0;
+#ifdef UTF8_SIMD_X64
+        // packing is signed; bias values so that 0..0xFFFF fits in a signed 16-bit integer
+        const __m128i max_bmp = _mm_set1_epi32(0xFFFF);
+        const __m128i bias32 = _mm_set1_epi32(0x8000);
+        const __m128i bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+        while (i + 8 <= nch) {
+            __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i));
+            __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i + 4));
+            if (_mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi32(lo, max_bmp), _mm_cmpgt_epi32(hi, max_bmp))) != 0) {
+                for (const size_t end = i + 8; i < end; i++) {
+                    out = encode_utf16(input_s[i], out);
+                }
+                continue;
+            }
+            __m128i units = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(lo, bias32), _mm_sub_epi32(hi, bias32)), bias16);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), units);
+            out += 8;
+            i += 8;
+        }
+#endif
+        for (; i < nch; i++) {
+            out = encode_utf16(input_s[i], out);
+        }
+    }
 }
 
 /*!
-  Creates a path from UTF-8 encoded components.
+  Return size of UTF-8 encoding of a string in a single byte character set
+  \param input_s   input string
+  \param high_map  code points of bytes 0x80 to 0x9F or `nullptr` for Latin-1
 
-  \param path   Resulting path (UTF-8 encoded)
-  \param drive  drive letter
-  \param dir    directory path
-  \param fname  filename
-  \param ext    extension
-  \return       True if successful; false otherwise
+  Bytes are counted 16 at a time.
+*/
+static auto single_byte_utf8_size(std::string_view input_s, const char16_t* high_map) -> size_t {
+    const auto* p = reinterpret_cast<const uint8_t*>(input_s.data());
+    const size_t nch = input_s.size();
+
+    // every byte above 0x7F needs 2 bytes; some Windows-1252 characters need 3
+    auto extra = [&](size_t i) -> size_t {
+        return (p[i] < 0x80) ? 0 : (high_map != nullptr && p[i] < 0xA0 && high_map[p[i] - 0x80] >= 0x800) ? 2 : 1;
+    };
+    size_t nbytes = nch;
+    size_t i = 0;
+#ifdef UTF8_SIMD_X64
+    // as signed bytes, 0x80 to 0x9F are below -96
+    const __m128i c1_limit = _mm_set1_epi8(static_cast<char>(0xA0));
+    for (; i + 16 <= nch; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        nbytes += static_cast<size_t>(std::popcount(static_cast<uint32_t>(_mm_movemask_epi8(bytes))));
+        if (high_map != nullptr) {
+            auto c1 = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmplt_epi8(bytes, c1_limit)));
+            for (; c1 != 0; c1 &= c1 - 1) {
+                nbytes += extra(i + static_cast<size_t>(std::countr_zero(c1))) - 1;
+            }
+        }
+    }
+#endif
+    for (; i < nch; i++) {
+        nbytes += extra(i);
+    }
+    return nbytes;
+}
 
-  If any required syntactic element (colon after drive letter, '\' at end of
-  directory path, colon before extension) is missing, it is automatically added.
+/*!
+  Conversion from a single byte character set to UTF-8
+  \param input_s   input string
+  \param high_map  code points of bytes 0x80 to 0x9F or `nullptr` for Latin-1
+
+  The exact size of the result is computed first. Runs of ASCII characters
+  are copied unchanged.
 */
-[[nodiscard]] auto makepath(std::string& path, std::string const& drive, std::string const& dir, std::string const& fname, std::string const& ext) -> bool {
-    wchar_t wpath[_MAX_PATH];
-    const auto make_path_safe = _wmakepath_s(wpath, widen(drive).c_str(), widen(dir).c_str(), widen(fname).c_str(), widen(ext).c_str());
-    if (make_path_safe != 0) {
+static auto single_byte_to_utf8(std::string_view input_s, const char16_t* high_map) -> std::string {
+    const auto* p = reinterpret_cast<const uint8_t*>(input_s.data());
+    const size_t nch = input_s.size();
+    const size_t nbytes = single_byte_utf8_size(input_s, high_map);
+
+    std::string out;
+    fill_string(out, nbytes, [&](char* buf) {
+        size_t pos = 0;
+        while (pos < nch) {
+            size_t nascii = ascii_run(input_s.data() + pos, nch - pos);
+            memcpy(buf, input_s.data() + pos, nascii);
+            buf += nascii;
+            pos += nascii;
+            for (; pos < nch && p[pos] >= 0x80; pos++) {
+                char32_t c = (high_map != nullptr && p[pos] < 0xA0) ? high_map[p[pos] - 0x80] : p[pos];
+                buf = detail::encode(c, buf);
+            }
+        }
+        return nbytes;
+    });
+    return out;
+}
+
+/*!
+  Conversion from UTF-8 to a single byte character set
+  \param input_s    UTF-8 encoded string
+  \param high_map   code points of bytes 0x80 to 0x9F or `nullptr` for Latin-1
+  \param substitute replacement for unmappable characters or `std::nullopt` to throw
+
+  Runs of ASCII characters are copied unchanged.
+*/
+static auto utf8_to_single_byte(std::string_view input_s, const char16_t* high_map, std::optional<char> substitute) -> std::string {
+    const char* ptr = input_s.data();
+    const char* last = ptr + input_s.size();
+    bool failed = false;
+    auto cause = exception::reason::unmappable;
+
+    std::string out;
+    fill_string(out, input_s.size(), [&](char* buf) {
+        char* first = buf;
+        while (ptr < last) {
+            size_t nascii = ascii_run(ptr, static_cast<size_t>(last - ptr));
+            memcpy(buf, ptr, nascii);
+            buf += nascii;
+            ptr += nascii;
+            if (ptr == last) {
+                break;
+            }
+
+            char32_t r;
+            bool valid = detail::decode(ptr, last, r);
+            int byte = -1;
+            if (valid) {
+                if (r >= 0xA0 && r <= 0xFF) {
+                    byte = static_cast<int>(r);
+                }
+                else if (high_map == nullptr) {
+                    byte = (r <= 0xFF) ? static_cast<int>(r) : -1;
+                }
+                else {
+                    const char16_t* pos = std::find(high_map, high_map + 32, r);
+                    byte = (pos != high_map + 32) ? static_cast<int>(0x80 + (pos - high_map)) : -1;
+                }
+            }
+            if (byte < 0) {
+                if (!substitute) {
+                    failed = true;
+                    cause = valid ? exception::reason::unmappable : exception::reason::invalid_utf8;
+                    break;
+                }
+                *buf++ = *substitute;
+            }
+            else {
+                *buf++ = static_cast<char>(byte);
+            }
+        }
+        return static_cast<size_t>(buf - first);
+    });
+    if (failed) {
+        throw exception(cause);
+    }
+    return out;
+}
+
+/*!
+  Split a UTF-8 string in chunks for the parallel functions
+
+  \param input_s string to split
+  \param nthreads maximum number of chunks or 0 for number of hardware threads
+  \return offsets of chunk boundaries, starting with 0 and ending with string size
+
+  Each boundary is moved forward past at most 3 continuation bytes, so that a
+  valid character is never split. A longer run of continuation bytes is
+  invalid anyway and the chunk after the boundary reports it at the same
+  offset as a serial scan would.
+*/
+static auto split_utf8(std::string_view input_s, unsigned int nthreads) -> std::vector<size_t> {
+    if (nthreads == 0) {
+        nthreads = std::max(std::thread::hardware_concurrency(), 1U);
+    }
+    const size_t nchunks = std::clamp<size_t>(input_s.size() / PARALLEL_MIN_CHUNK, 1, nthreads);
+
+    std::vector<size_t> bounds{ 0 };
+    for (size_t i = 1; i < nchunks; i++) {
+        size_t pos = std::max(input_s.size() / nchunks * i, bounds.back());
+        for (int j = 0; j < 3 && pos < input_s.size() && (input_s[pos] & 0xC0) == 0x80; j++) {
+            pos++;
+        }
+        if (pos > bounds.back() && pos < input_s.size()) {
+            bounds.push_back(pos);
+        }
+    }
+    bounds.push_back(input_s.size());
+    return bounds;
+}
+
+/*!
+  Call `work(i)` for each chunk `i`, chunk 0 on the calling thread and the
+  others on new threads. If a thread cannot be started, its chunk runs on the
+  calling thread.
+
+  The function itself doesn't throw (it is called inside `resize_and_overwrite`):
+  when there is no memory for a thread, its chunk also runs on the calling thread.
+*/
+template <typename F>
+static void run_parallel(size_t nchunks, F work) {
+    std::vector<std::thread> workers;
+    try {
+        workers.reserve(nchunks - 1);
+    }
+    catch (std::bad_alloc const&) {
+        // threads are still started below while emplace_back() finds memory
+    }
+    for (size_t i = 1; i < nchunks; i++) {
+        try {
+            workers.emplace_back(work, i);
+        }
+        catch (std::system_error const&) {
+            work(i);
+        }
+        catch (std::bad_alloc const&) {
+            work(i);
+        }
+    }
+    work(0);
+    for (auto& t : workers) {
+        t.join();
+    }
+}
+
+/// Count bytes that are not continuation bytes (10xxxxxx)
+static auto count_runes(const char* input_s, size_t nch) -> size_t {
+    size_t nc = 0;
+    size_t i = 0;
+#ifdef UTF8_SIMD_X64
+    // as signed bytes, continuation bytes are in [-128, -65]
+    const __m128i cont_max = _mm_set1_epi8(static_cast<char>(0xBF));
+    for (; i + 64 <= nch; i += 64) {
+        const auto* p = reinterpret_cast<const __m128i*>(input_s + i);
+        auto m0 = static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_loadu_si128(p), cont_max))));
+        auto m1 = static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_loadu_si128(p + 1), cont_max))));
+        auto m2 = static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_loadu_si128(p + 2), cont_max))));
+        auto m3 = static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_loadu_si128(p + 3), cont_max))));
+        nc += static_cast<size_t>(std::popcount(m0 | m1 << 16 | m2 << 32 | m3 << 48));
+    }
+    for (; i + 16 <= nch; i += 16) {
+        auto m = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input_s + i)), cont_max)));
+        nc += static_cast<size_t>(std::popcount(m));
+    }
+#endif
+    for (; i < nch; i++) {
+        if ((input_s[i] & 0xC0) != 0x80) {
+            nc++;
+        }
+    }
+    return nc;
+}
+
+/*!
+  Find why the encoding at `ptr` is invalid
+  \param ptr   beginning of invalid encoding
+  \param last  end of string
+*/
+static auto classify_error(const char* ptr, const char* last) -> validation_result::error_kind {
+    auto lead = static_cast<uint8_t>(*ptr);
+    if (lead >= 0x80 && lead <= 0xBF) {
+        return validation_result::stray_continuation;
+    }
+    if (lead == 0xC0 || lead == 0xC1) {
+        return validation_result::overlong;
+    }
+    if (lead >= 0xF5 && lead <= 0xF7) {
+        return validation_result::too_large;
+    }
+    if (lead >= 0xF8) {
+        return validation_result::invalid_byte;
+    }
+
+    size_t cont = (lead >= 0xF0) ? 3 : (lead >= 0xE0) ? 2 : 1;
+    for (size_t i = 1; i <= cont; i++) {
+        if (ptr + i == last || (ptr[i] & 0xC0) != 0x80) {
+            return validation_result::truncated;
+        }
+        if (i == 1) {
+            auto b = static_cast<uint8_t>(ptr[1]);
+            if ((lead == 0xE0 && b < 0xA0) || (lead == 0xF0 && b < 0x90)) {
+                return validation_result::overlong;
+            }
+            if (lead == 0xED && b >= 0xA0) {
+                return validation_result::surrogate;
+            }
+            if (lead == 0xF4 && b >= 0x90) {
+                return validation_result::too_large;
+            }
+        }
+    }
+    return validation_result::none; // not reached for invalid encodings
+}
+
+/*!
+  Skip characters
+  \param ptr  pointer to beginning of a character
+  \param last end of string
+  \param n    number of characters to skip
+  \return pointer to the character `n` positions after `ptr` or `last`
+*/
+static auto skip_runes(const char* ptr, const char* last, size_t n) -> const char* {
+    if (n == 0) {
+        return ptr;
+    }
+    ++ptr; // look for character starts after current one
+#ifdef UTF8_SIMD_X64
+    // skip whole blocks of 16 bytes that don't contain the target
+    const __m128i cont_max = _mm_set1_epi8(static_cast<char>(0xBF));
+    while (last - ptr >= 16) {
+        auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr)), cont_max)));
+        auto cnt = static_cast<size_t>(std::popcount(mask));
+        if (cnt >= n) {
+            break;
+        }
+        n -= cnt;
+        ptr += 16;
+    }
+#endif
+    for (; ptr < last; ptr++) {
+        if ((*ptr & 0xC0) != 0x80 && --n == 0) {
+            break;
+        }
+    }
+    return ptr;
+}
+
+/*!
+  Decode character before pointer and move pointer to its beginning
+
+  \param ptr   iterator or pointer after the character; must be different from `first`
+  \param first beginning of string
+  \param rune  decoded character
+  \return `false` if the encoding is invalid; in this case the pointer is not moved
+*/
+template <typename It>
+static auto decode_prev(It& ptr, const It first, char32_t& rune) -> bool {
+    It start = ptr;
+    --start;
+    for (int i = 0; i < 3 && start != first && (*start & 0xC0) == 0x80; i++) {
+        --start;
+    }
+    It end = start;
+    if (detail::decode(end, ptr, rune) && end == ptr) {
+        ptr = start;
+        return true;
+    }
+    rune = REPLACEMENT_CHARACTER;
+    return false;
+}
+
+/// Validate a UTF-8 string using the best implementation for this processor
+static auto validate_buf(const char* input_s, size_t nch) -> bool {
+    using validate_fn = bool (*)(const char*, size_t);
+    static const validate_fn impl = []() -> validate_fn {
+#ifdef UTF8_SIMD_X64
+        if (cpu_has_avx2()) {
+            return validate_avx2;
+        }
+#endif
+        return validate_scalar;
+    }();
+    return impl(input_s, nch);
+}
+
+
+/*!
+  \class stream_decoder
+
+  Decodes or validates a UTF-8 stream received in chunks of arbitrary size.
+  A character split between two chunks is completed when the next chunk
+  arrives; chunks are read in place, without being copied.
+
+\code
+  utf8::stream_decoder dec;
+  std::u32string text;
+  while ((n = recv(sock, buf, sizeof(buf), 0)) > 0) {
+    if (!dec.feed(std::string_view(buf, n), text))
+      break; // invalid encoding at dec.error_offset()
+  }
+  bool ok = dec.finish(); // false if stream ended inside a character
+\endcode
+*/
+
+/*!
+  Validate a chunk of input
+
+  \param chunk next chunk of the stream
+  \return `false` if the stream contains an invalid encoding
+
+  Complete characters are checked with the vectorized validator; only the
+  characters straddling chunk boundaries go through the scalar automaton.
+*/
+auto stream_decoder::feed(std::string_view chunk) -> bool {
+    if (!valid()) {
+        return false;
+    }
+    const char* ptr = chunk.data();
+    const char* last = ptr + chunk.size();
+
+    // finish the character left over from previous chunk
+    while (ptr < last && state > detail::DFA_REJECT) {
+        state = detail::dfa_next[state + detail::dfa_class[static_cast<uint8_t>(*ptr++)]];
+    }
+    if (state == detail::DFA_REJECT) {
+        err_offset = seq_start;
         return false;
     }
 
-    path = narrow(wpath);
-    return true;
+    // last character may be incomplete; keep it for the automaton
+    const char* tail = last;
+    for (int i = 0; i < 3 && tail > ptr && (tail[-1] & 0xC0) == 0x80; i++) {
+        --tail;
+    }
+    if (tail > ptr) {
+        --tail;
+    }
+
+    if (!validate_buf(ptr, static_cast<size_t>(tail - ptr))) {
+        tail = ptr; // rescan everything to locate the error
+    }
+    bool ok = scan(chunk, static_cast<size_t>(tail - chunk.data()), nullptr);
+    consumed += chunk.size();
+    return ok;
 }
 
 /*!
-  Returns the absolute (full) path of a filename
-  \param relpath relative path
+  Decode a chunk of input
+
+  \param chunk  next chunk of the stream
+  \param output string where decoded characters are appended
+  \return `false` if the stream contains an invalid encoding
+
+  Decoding stops at the first invalid encoding; all characters before it are
+  appended to output.
 */
-[[nodiscard]] auto fullpath(std::string const& relpath) -> std::string {
-    wchar_t wpath[_MAX_PATH];
-    const wchar_t* full_path = _wfullpath(wpath, widen(relpath).c_str(), _MAX_PATH);
-    if (full_path != nullptr) {
-        return narrow(wpath);
+auto stream_decoder::feed(std::string_view chunk, std::u32string& output) -> bool {
+    if (!valid()) {
+        return false;
     }
-    return std::string();
+    bool ok = scan(chunk, 0, &output);
+    consumed += chunk.size();
+    return ok;
 }
 
 /*!
-  Retrieves the value of an environment variable
-  \param  var name of environment variable
-  \return value of environment variable or an empty string if there is no such
-          environment variable
+  Signal end of stream
+
+  \return `true` if the whole stream was valid and didn't end in the middle of
+  a character
 */
-[[nodiscard]] auto getenv(std::string const& var) -> std::string {
-    size_t nsz{};
-    std::wstring wvar = widen(var);
-    _wgetenv_s(&nsz, 0, 0, wvar.c_str());
-    if (nsz == 0U) {
-        return std::string();
+auto stream_decoder::finish() -> bool {
+    if (pending()) {
+        err_offset = seq_start; // truncated character
     }
+    return valid();
+}
 
-    std::wstring wval(nsz, L'\0');
-    _wgetenv_s(&nsz, wval.data(), nsz, wvar.c_str());
-    wval.resize(nsz - 1);
-    return narrow(wval);
+/// Prepare decoder for a new stream
+void stream_decoder::reset() {
+    *this = stream_decoder();
+}
+
+/// Run decoding automaton over current chunk starting at `pos`
+auto stream_decoder::scan(std::string_view chunk, size_t pos, std::u32string* output) -> bool {
+    const char* first = chunk.data();
+    const char* ptr = first + pos;
+    const char* last = first + chunk.size();
+    while (ptr < last) {
+        if (state == detail::DFA_ACCEPT) {
+            size_t nascii = ascii_run(ptr, static_cast<size_t>(last - ptr));
+            if (nascii != 0U && output != nullptr) {
+                size_t sz = output->size();
+                output->resize(sz + nascii);
+                widen_ascii(ptr, nascii, output->data() + sz);
+            }
+            ptr += nascii;
+            if (ptr == last) {
+                break;
+            }
+            seq_start = consumed + static_cast<size_t>(ptr - first);
+        }
+        state = detail::dfa_step(state, static_cast<uint8_t>(*ptr++), rune);
+        if (state == detail::DFA_ACCEPT && output != nullptr) {
+            output->push_back(rune);
+        }
+        else if (state == detail::DFA_REJECT) {
+            err_offset = seq_start;
+            return false;
+        }
+    }
+    return true;
 }
 
 /*!
-  Converts wide byte command arguments to an array of pointers
-  to UTF-8 strings.
+  \class string_index
 
-  \param  argc Pointer to an integer that contains number of parameters
-  \return array of pointers to each command line parameter or NULL if an error
-  occurred.
+  Side index over a UTF-8 string that records the byte offset of every
+  string_index::stride-th character. Finding the n-th character needs one
+  table lookup and a scan of less than `stride` characters, instead of
+  decoding the string from the beginning.
 
-  The space allocated for strings and array of pointers should be freed
-  by calling free_utf8argv()
+  The index refers to the string; it must not outlive it and it must be
+  rebuilt if the string changes.
+\code
+  utf8::string_index idx(document);
+  char32_t c = idx.at(100000);
+  std::string_view word = idx.substr(100000, 10);
+\endcode
 */
-[[nodiscard]] auto get_argv(int* argc) -> char** {
-    char** uargv = nullptr;
-    wchar_t** wargv = CommandLineToArgvW(GetCommandLineW(), argc);
-    if (wargv != nullptr) {
-        uargv = new char*[static_cast<size_t>(*argc)];
-        for (int32_t i = 0; i < *argc; i++) {
-            int32_t nc = WideCharToMultiByte(CP_UTF8, 0, wargv[i], -1, 0, 0, 0, 0);
-            uargv[i] = new char[static_cast<size_t>(nc + 1)];
-            WideCharToMultiByte(CP_UTF8, 0, wargv[i], -1, uargv[i], nc, 0, 0);
+
+/*!
+  Build index for a string
+  \param p_str UTF-8 string to be indexed
+
+  Characters are counted 64 bytes at a time; only blocks containing an
+  indexed position are scanned byte by byte.
+*/
+string_index::string_index(std::string_view p_str)
+    : str(p_str) {
+    const char* first = str.data();
+    const size_t nbytes = str.size();
+    size_t next_mark = 0; // index of next character to be recorded
+    size_t pos = 0;
+    for (; pos + 64 <= nbytes; pos += 64) {
+        size_t cnt = count_runes(first + pos, 64);
+        if (nchars + cnt > next_mark) {
+            size_t idx = nchars;
+            for (size_t i = pos; i < pos + 64; i++) {
+                if ((first[i] & 0xC0) != 0x80 && idx++ == next_mark) {
+                    marks.push_back(i);
+                    next_mark += stride;
+                }
+            }
+        }
+        nchars += cnt;
+    }
+    for (; pos < nbytes; pos++) {
+        if ((first[pos] & 0xC0) != 0x80 && nchars++ == next_mark) {
+            marks.push_back(pos);
+            next_mark += stride;
         }
-        LocalFree(wargv);
     }
-    return uargv;
 }
 
 /*!
-  Frees the memory allocated by get_argv(int *argc)
-
-  \param  argc  number of arguments
-  \param  argv  array of pointers to arguments
+  Return byte offset of a character
+  \param n character index
+  \return offset of n-th character or string size if `n >= length()`
 */
-void free_argv(int32_t argc, char** argv) {
-    for (int32_t i = 0; i < argc; i++) {
-        delete argv[i];
+auto string_index::offset(size_t n) const -> size_t {
+    if (n >= nchars) {
+        return str.size();
     }
-    delete argv;
+    const char* first = str.data();
+    const char* ptr = first + marks[n / stride];
+    return static_cast<size_t>(skip_runes(ptr, first + str.size(), n % stride) - first);
 }
 
 /*!
-  Converts wide byte command arguments to UTF-8 to a vector of UTF-8 strings.
-
-  \return vector of UTF-8 strings. The vector is empty if an error occurred.
+  Return a character
+  \param n character index
+  \return n-th character or REPLACEMENT_CHARACTER (0xfffd) if `n >= length()`
+           or the character is not a valid UTF-8 encoding
 */
-[[nodiscard]] auto get_argv() -> std::vector<std::string> {
-    int32_t argc{};
-    std::vector<std::string> uargv;
-
-    wchar_t** wargv = CommandLineToArgvW(GetCommandLineW(), &argc);
-    if (wargv != nullptr) {
-        for (int32_t i = 0; i < argc; i++) {
-            uargv.push_back(narrow(wargv[i]));
-        }
-        LocalFree(wargv);
-    }
-    return uargv;
+auto string_index::at(size_t n) const -> char32_t {
+    const char* ptr = str.data() + offset(n);
+    return next(ptr, str.data() + str.size());
 }
 
 /*!
-  \defgroup charclass Character Classification Functions
-  Replacements for character classification functions.
+  Return part of indexed string
+  \param pos    index of first character
+  \param count  number of characters or `npos` for all remaining characters
+  \return substring starting at `pos` character
+*/
+auto string_index::substr(size_t pos, size_t count) const -> std::string_view {
+    size_t first = offset(pos);
+    size_t last = (count >= nchars - std::min(pos, nchars)) ? str.size() : offset(pos + count);
+    return str.substr(first, last - first);
+}
 
-  According to C standard, the [is...](https://en.cppreference.com/w/cpp/header/cctype)
-  family of functions have undefined behavior if the argument is outside the
-  range of printable characters. These replacement functions are well-behaved
-  for any input string.
+/*!
+  \class codepoints
 
-  The argument is a character pointer or a string iterator. Use them as in the
-  following example:
+  Lightweight view that presents a UTF-8 string as a sequence of `char32_t`
+  characters, without decoding it into a separate buffer. It works with
+  range-based `for` loops and `std::ranges` algorithms:
 \code
-  //skip spaces in UTF-8 string
-  string s{ u8" \xA0日本語" };
-  auto p = s.begin ();
-  int blanks = 0;
-  while (p != s.end () && utf8::isspace (p))
-  {
-    blanks++;
-    utf8::next (p, s.end ());
-  }
-  assert (blanks == 2); //both space and "no-break space" are space characters
-  //...
+  for (char32_t c : utf8::codepoints(text))
+    ...
+  auto pos = std::ranges::find(utf8::codepoints(text), U'€');
 \endcode
-
+  Characters are decoded when the iterator is dereferenced. Each invalid
+  encoding is presented as one REPLACEMENT_CHARACTER (0xfffd).
 */
 
 /*!
-  Return true if character is blank(-ish).
-  \param p_check pointer to character to check
-  \return `true` if character is blank, `false` otherwise
-
-  Returns `true` if Unicode character has the "White_Space=yes" property in the
-  [Unicode Character Database](https://www.unicode.org/Public/UCD/latest/ucd/PropList.txt)
+  Move a codepoints iterator by a number of characters
+  \param it iterator to be moved
+  \param n  number of characters; negative values move backwards
+
+  Unlike `std::advance`, characters are counted 16 bytes at a time without
+  being decoded; the iterator is stepped one character at a time only if the
+  skipped part contains invalid encodings. The iterator stops at the beginning
+  or at the end of the string.
 */
-[[nodiscard]] auto isspace(const char* p_check) -> bool {
-    const char32_t spacetab[]{ 0x20,   0x09,   0x0d,   0x0a,   0x0b,   0x0c,   0x85,   0xA0,   0x1680, 0x2000, 0x2001, 0x2002,
-                               0x2004, 0x2005, 0x2006, 0x2007, 0x2008, 0x2009, 0x200A, 0x2028, 0x2020, 0x202f, 0x205f, 0x3000 };
-
-    char32_t c = rune(p_check);
-    for (auto i = 0; i < _countof(spacetab); i++) {
-        if (c == spacetab[i]) {
-            return true;
+void advance(codepoints::iterator& it, std::ptrdiff_t n) {
+    if (n > 0) {
+        const char* target = skip_runes(it.ptr, it.last, static_cast<size_t>(n));
+        if (validate_buf(it.ptr, static_cast<size_t>(target - it.ptr))) {
+            it.ptr = target;
+            return;
+        }
+        // invalid encodings don't always start with a lead byte; step through them
+        for (; n > 0 && it.ptr != it.last; n--) {
+            ++it;
+        }
+    } else if (n < 0) {
+        const char* target = it.ptr;
+        retreat(target, it.first, static_cast<size_t>(-n));
+        if (validate_buf(target, static_cast<size_t>(it.ptr - target))) {
+            it.ptr = target;
+            return;
+        }
+        for (; n < 0 && it.ptr != it.first; n++) {
+            --it;
         }
     }
-
-    return false;
 }
 
-// ----------------------- Low level internal functions -----------------------
-
-/// Encode a character and append it to a string
-void encode(char32_t input_char, std::string& input_s) {
-    if (input_char < 0x7f) {
-        input_s.push_back(static_cast<char>(input_char));
-    }
-    else if (input_char < 0x7ff) {
-        input_s.push_back(static_cast<char>(0xC0 | input_char >> 6));
-        input_s.push_back(static_cast<char>(0x80 | input_char & 0x3f));
-    }
-    else if (input_char < 0xFFFF) {
-        if (input_char >= 0xD800 && input_char <= 0xdfff) {
-            throw exception(exception::reason::invalid_char32);
-        }
-        input_s.push_back(static_cast<char>(0xE0 | input_char >> 12));
-        input_s.push_back(static_cast<char>(0x80 | input_char >> 6 & 0x3f));
-        input_s.push_back(static_cast<char>(0x80 | input_char & 0x3f));
+/*!
+  Return number of characters between two codepoints iterators
+  \param from first iterator
+  \param to   second iterator
+  \return number of characters; negative if `to` is before `from`
+*/
+auto distance(codepoints::iterator from, codepoints::iterator to) -> std::ptrdiff_t {
+    if (to.ptr < from.ptr) {
+        return -distance(to, from);
     }
-    else if (input_char < 0x10ffff) {
-        input_s.push_back(static_cast<char>(0xF0 | input_char >> 18));
-        input_s.push_back(static_cast<char>(0x80 | input_char >> 12 & 0x3f));
-        input_s.push_back(static_cast<char>(0x80 | input_char >> 6 & 0x3f));
-        input_s.push_back(static_cast<char>(0x80 | input_char & 0x3f));
+    auto nbytes = static_cast<size_t>(to.ptr - from.ptr);
+    if (validate_buf(from.ptr, nbytes)) {
+        return static_cast<std::ptrdiff_t>(count_runes(from.ptr, nbytes));
     }
-    else {
-        throw exception(exception::reason::invalid_char32);
+    std::ptrdiff_t cnt = 0;
+    for (; from != to; ++from) {
+        cnt++;
     }
+    return cnt;
 }
 
+/*!
+  Move to previous character
+
+  Stops at the same positions as forward iteration: a valid character followed
+  by stray continuation bytes is two characters.
+*/
+auto codepoints::iterator::operator--() -> iterator& {
+    const char* start = ptr;
+    retreat(start, first, 1);
+    const char* end = start;
+    char32_t rune;
+    if (start != ptr && detail::decode(end, ptr, rune) && end != ptr) {
+        start = end;
+    }
+    ptr = start;
+    return *this;
+}
 
 /*!
   \class exception
 
   Most UTF8 functions will throw an exception if input string is not a valid
-  encoding. So far there are two possible causes:
+  encoding. So far there are three possible causes:
   - `invalid_utf8` if the string is not a valid UTF-8 encoding
   - `invalid_char32` if the string is not a valid UTF-32 codepoint.
+  - `unmappable` if a character doesn't exist in a single byte character set
 
   You can handle a utf8::exception using code like this:
 \code
@@ -1486,19 +4242,24 @@ void encode(char32_t input_char, std::string& input_s) {
   toupper() and tolower() functions and their in-place counterparts
   make_upper() and make_lower(), use standard tables published by Unicode
   Consortium to perform case folding.
-  There is also a function, icompare(), that performs string comparison ignoring
+  There are also functions, icompare(), icompare_n(), istarts_with() and
+  iends_with(), that perform string comparison ignoring
   the case.
 
-  If input strings are not valid UTF-8 encoded strings, these function will
-  throw a utf8::exception.
+  These functions don't throw on invalid UTF-8. Each invalid sequence is
+  replaced by REPLACEMENT_CHARACTER (0xfffd): tolower(), toupper(),
+  make_lower() and make_upper() write it to the output, and the comparison
+  functions compare it like any other character.
 
   A small ancillary program (gen_casetab) converts the original table
   in two tables of equal size, one with the upper case letters and the other
-  with the lower case ones. The upper case table is sorted to allow for
-  binary searching. If a code is found in the upper case table, it is replaced
-  with the matching code from the lower case.
+  with the lower case ones. These tables are used only at compile time, to
+  build two-stage lookup tables: code points are split in blocks of 32 and the
+  first stage gives, for each block, the row of the second stage that holds the
+  mapping of every code point in the block. Blocks without mappings share row 0.
 
-  Case folding tables take about 22k. Finding a code takes at most 11 comparisons.
+  Each direction of the two-stage tables takes under 10k. Finding a code takes
+  two dependent memory reads.
 */
 
 // definition of 'u2l' and 'lc' tables
@@ -4549,6 +7310,78 @@ static constexpr char32_t uc[1427] = { 0x00041, //  LATIN CAPITAL LETTER A
                                        0x1e921 }; //  ADLAM CAPITAL LETTER SHA
 
 
+/// Code points per block of the case mapping tables, as power of 2
+constexpr unsigned int CASE_BLOCK_BITS = 5;
+/// Code points starting from this value have no case mapping
+constexpr char32_t CASE_LIMIT = ((std::max(std::end(u2l)[-1], std::end(l2u)[-1]) >> CASE_BLOCK_BITS) + 1) << CASE_BLOCK_BITS;
+
+/// Number of second stage rows needed for the code points in `from`, including the empty row
+template <size_t N>
+consteval auto case_table_rows(const char32_t (&from)[N]) -> size_t {
+    std::array<bool, (CASE_LIMIT >> CASE_BLOCK_BITS)> used{};
+    size_t nrows = 1;
+    for (char32_t c : from) {
+        if (!used[c >> CASE_BLOCK_BITS]) {
+            used[c >> CASE_BLOCK_BITS] = true;
+            nrows++;
+        }
+    }
+    return nrows;
+}
+
+/// Number of second stage rows in a case mapping table, enough for both mappings
+constexpr size_t CASE_ROWS = std::max(case_table_rows(u2l), case_table_rows(l2u));
+
+/*!
+  Two-stage case mapping table
+
+  Case pairs never cross a 64k plane, so the second stage stores the
+  difference between mapped code and code point modulo 0x10000.
+*/
+struct case_table {
+    uint8_t row[CASE_LIMIT >> CASE_BLOCK_BITS]; ///< row of `delta` for each block
+    uint16_t delta[CASE_ROWS][1 << CASE_BLOCK_BITS]; ///< mapped code minus code point; 0 if not mapped
+
+    /// Return mapped code or `c` if there is no mapping
+    [[nodiscard]] constexpr auto map(char32_t c) const -> char32_t {
+        if (c >= CASE_LIMIT) {
+            return c;
+        }
+        char32_t d = delta[row[c >> CASE_BLOCK_BITS]][c & ((1 << CASE_BLOCK_BITS) - 1)];
+        return (c & ~char32_t{ 0xFFFF }) | ((c + d) & 0xFFFF);
+    }
+};
+
+/*!
+  Build a two-stage case mapping table
+  \param from sorted code points
+  \param to   mapped code points
+
+  When a code point appears more than once, the first mapping is used.
+*/
+template <size_t N>
+consteval auto make_case_table(const char32_t (&from)[N], const char32_t (&to)[N]) -> case_table {
+    static_assert(CASE_ROWS <= 256, "Case table rows don't fit in first stage");
+    case_table tab{};
+    size_t nrows = 1;
+    for (size_t i = 0; i < N; i++) {
+        uint8_t& r = tab.row[from[i] >> CASE_BLOCK_BITS];
+        if (r == 0) {
+            r = static_cast<uint8_t>(nrows++);
+        }
+        uint16_t& d = tab.delta[r][from[i] & ((1 << CASE_BLOCK_BITS) - 1)];
+        if (d == 0) {
+            d = static_cast<uint16_t>(to[i] - from[i]);
+        }
+    }
+    return tab;
+}
+
+/// Upper case to lower case mapping
+static constexpr case_table lower_map = make_case_table(u2l, lc);
+/// Lower case to upper case mapping
+static constexpr case_table upper_map = make_case_table(l2u, uc);
+
 /// Return `true` if character is a lowercase character
 /// \param p_char pointer to character to check
 [[nodiscard]] auto islower(const char* p_char) -> bool {
@@ -4557,10 +7390,9 @@ static constexpr char32_t uc[1427] = { 0x00041, //  LATIN CAPITAL LETTER A
         return ::islower(*p_char) != 0;
     }
 
-    // search character in lowercase table
+    // a lowercase character has an uppercase mapping
     char32_t r = rune(p_char);
-    const char32_t* f = std::lower_bound(std::begin(l2u), std::end(l2u), r);
-    return (f != std::end(l2u) && *f == r);
+    return upper_map.map(r) != r;
 }
 
 /*!
@@ -4574,30 +7406,67 @@ static constexpr char32_t uc[1427] = { 0x00041, //  LATIN CAPITAL LETTER A
 */
 
 [[nodiscard]] auto tolower(std::string const& str) -> std::string {
-    std::u32string wstr;
-    auto ptr = str.begin();
-    while (ptr < str.end()) {
-        char32_t c = next(ptr, str.end());
-        const char32_t* f = std::lower_bound(std::begin(u2l), std::end(u2l), c);
-        if (f != std::end(u2l) && *f == c) {
-            wstr.push_back(lc[f - u2l]);
+    return tolower(std::string_view(str), std::allocator<char>());
+}
+
+/*!
+  Change case of a string in place
+  \param str       UTF-8 encoded string
+  \param map       case mapping table
+  \param upper     `true` if `map` converts to upper case
+  \param fold_into function that converts the rest of the string if the
+                   size of a character changes
+
+  Characters are rewritten in place as long as their mapping has an encoding
+  of the same size; invalid encodings become REPLACEMENT_CHARACTER, like in
+  tolower() and toupper().
+*/
+static void fold_in_place(std::string& str, case_table const& map, bool upper, size_t (*fold_into)(std::string_view, std::span<char>)) {
+    char* ptr = str.data();
+    char* last = ptr + str.size();
+    while (ptr < last) {
+        ptr += ascii_case(ptr, static_cast<size_t>(last - ptr), ptr, upper);
+        if (ptr == last) {
+            break;
         }
-        else {
-            wstr.push_back(c);
+        const char* p = ptr;
+        char32_t c;
+        const bool valid = detail::decode(p, static_cast<const char*>(last), c);
+        const auto len = static_cast<size_t>(p - ptr);
+        const char32_t m = map.map(c);
+        if (!valid || m != c) {
+            char enc[4];
+            if (static_cast<size_t>(detail::encode(m, enc) - enc) != len) {
+                break;
+            }
+            std::copy_n(enc, len, ptr);
         }
+        ptr += len;
+    }
+    if (ptr == last) {
+        return;
     }
-    return narrow(wstr);
+
+    // size changes; convert the rest once into a new tail
+    const auto pos = static_cast<size_t>(ptr - str.data());
+    const std::string_view rest(ptr, static_cast<size_t>(last - ptr));
+    std::string tail;
+    const size_t nbytes = fold_into(rest, std::span<char>());
+    fill_string(tail, nbytes, [&](char* buf) { return fold_into(rest, std::span<char>(buf, nbytes)); });
+    str.replace(pos, std::string::npos, tail);
 }
 
 /*!
   In place version converts a UTF-8 encoded string to lowercase
   \param str  UTF-8 encoded string to be converted
 
-  Note that, in general, the size of the resulting string will be different from
-  that of the original string.
+  Characters are rewritten in place when their lower case has the same size,
+  which is almost always the case. Otherwise, the rest of the string is
+  converted in a second pass. Note that, in general, the size of the resulting
+  string can be different from that of the original string.
 */
 void make_lower(std::string& str) {
-    str = tolower(str);
+    fold_in_place(str, lower_map, false, tolower_into);
 }
 
 /// Return `true` if character is an uppercase character
@@ -4608,10 +7477,9 @@ void make_lower(std::string& str) {
         return ::isupper(*p_char) != 0;
     }
 
-    // search character in uppercase table
+    // an uppercase character has a lowercase mapping
     char32_t r = rune(p_char);
-    const char32_t* f = std::lower_bound(std::begin(u2l), std::end(u2l), r);
-    return (f != std::end(u2l) && *f == r);
+    return lower_map.map(r) != r;
 }
 
 /*!
@@ -4624,30 +7492,146 @@ void make_lower(std::string& str) {
   (http://www.unicode.org/Public/UCD/latest/ucd/CaseFolding.txt)
 */
 [[nodiscard]] auto toupper(std::string const& str) -> std::string {
-    std::u32string wstr;
-    auto ptr = str.begin();
-    while (ptr < str.end()) {
-        char32_t c = next(ptr, str.end());
-        const char32_t* f = std::lower_bound(std::begin(l2u), std::end(l2u), c);
-        if (f != std::end(l2u) && *f == c) {
-            wstr.push_back(uc[f - l2u]);
+    return toupper(std::string_view(str), std::allocator<char>());
+}
+
+/*!
+  In place version converts a UTF-8 encoded string to uppercase.
+  \param str  string to be converted
+
+  Characters are rewritten in place when their upper case has the same size,
+  which is almost always the case. Otherwise, the rest of the string is
+  converted in a second pass. Note that, in general, the size of the resulting
+  string can be different from that of the original string.
+*/
+void make_upper(std::string& str) {
+    fold_in_place(str, upper_map, true, toupper_into);
+}
+
+/*!
+  Change case of a string into a buffer
+  \param input_s UTF-8 encoded string
+  \param output  output buffer
+  \param map     case mapping table
+  \param upper   `true` if `map` converts to upper case
+  \return size of converted string
+
+  Runs of ASCII characters are converted by ascii_case(); other characters are
+  decoded and mapped one by one.
+*/
+static auto case_into(std::string_view input_s, std::span<char> output, case_table const& map, bool upper) -> size_t {
+    const char* ptr = input_s.data();
+    const char* last = ptr + input_s.size();
+    size_t nbytes = 0;
+    while (ptr < last) {
+        const auto rest = static_cast<size_t>(last - ptr);
+        size_t nascii;
+        if (nbytes + rest <= output.size()) {
+            nascii = ascii_case(ptr, rest, output.data() + nbytes, upper);
         }
         else {
-            wstr.push_back(c);
+            // output may be too small; count the run and write it only if it fits
+            nascii = ascii_run(ptr, rest);
+            if (nbytes + nascii <= output.size()) {
+                (void)ascii_case(ptr, nascii, output.data() + nbytes, upper);
+            }
+        }
+        ptr += nascii;
+        nbytes += nascii;
+        if (ptr == last) {
+            break;
         }
+
+        char32_t c = map.map(next(ptr, last));
+        char enc[4];
+        const auto len = static_cast<size_t>(detail::encode(c, enc) - enc);
+        if (nbytes + len <= output.size()) {
+            std::copy_n(enc, len, output.data() + nbytes);
+        }
+        nbytes += len;
     }
-    return narrow(wstr);
+    return nbytes;
 }
 
 /*!
-  In place version converts a UTF-8 encoded string to lowercase.
-  \param str  string to be converted
+  Convert UTF-8 string to lower case into a buffer
+
+  \param input_s UTF-8 string to convert
+  \param output  output buffer
+  \return size of lower case string
 
-  Note that, in general, the size of the resulting string will be different from
-  that of the original string.
+  Characters are written while they fit in the buffer; if the returned size is
+  larger than the buffer, the output is incomplete.
 */
-void make_upper(std::string& str) {
-    str = toupper(str);
+[[nodiscard]] auto tolower_into(std::string_view input_s, std::span<char> output) -> size_t {
+    return case_into(input_s, output, lower_map, false);
+}
+
+/*!
+  Convert UTF-8 string to upper case into a buffer
+
+  \param input_s UTF-8 string to convert
+  \param output  output buffer
+  \return size of upper case string
+
+  Characters are written while they fit in the buffer; if the returned size is
+  larger than the buffer, the output is incomplete.
+*/
+[[nodiscard]] auto toupper_into(std::string_view input_s, std::span<char> output) -> size_t {
+    return case_into(input_s, output, upper_map, true);
+}
+
+/*!
+  Compare characters of two strings in a case-insensitive way
+  \param p1    pointer in first string; advanced past the characters compared
+  \param last1 end of first string
+  \param p2    pointer in second string; advanced past the characters compared
+  \param last2 end of second string
+  \param n     maximum number of characters to compare; decremented by the
+               number of equal characters
+  \return <0, 0 or >0 like icompare(); 0 when one of the strings or `n` ends
+
+  Blocks of 16 ASCII characters are lowered and compared at once. Other
+  characters are decoded and lowered through the case tables.
+*/
+static auto icompare_chars(const char*& p1, const char* last1, const char*& p2, const char* last2, size_t& n) -> int32_t {
+#ifdef UTF8_SIMD_X64
+    const __m128i before_a = _mm_set1_epi8('A' - 1);
+    const __m128i after_z = _mm_set1_epi8('Z' + 1);
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    auto lower = [&](__m128i v) {
+        __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(v, before_a), _mm_cmplt_epi8(v, after_z));
+        return _mm_or_si128(v, _mm_and_si128(letters, case_bit));
+    };
+#endif
+    while (p1 < last1 && p2 < last2 && n != 0) {
+#ifdef UTF8_SIMD_X64
+        // skip equal ASCII characters; stop at the first difference or non-ASCII byte
+        while (last1 - p1 >= 16 && last2 - p2 >= 16 && n >= 16) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p1));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p2));
+            auto stop = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(lower(a), lower(b)))) ^ 0xFFFFU;
+            stop |= static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(a, b)));
+            const auto k = stop != 0 ? static_cast<size_t>(std::countr_zero(stop)) : size_t{ 16 };
+            p1 += k;
+            p2 += k;
+            n -= k;
+            if (k < 16) {
+                break;
+            }
+        }
+        if (p1 == last1 || p2 == last2 || n == 0) {
+            break;
+        }
+#endif
+        char32_t lc1 = lower_map.map(next(p1, last1));
+        char32_t lc2 = lower_map.map(next(p2, last2));
+        if (lc1 != lc2) {
+            return (lc1 < lc2) ? -1 : 1;
+        }
+        n--;
+    }
+    return 0;
 }
 
 /*!
@@ -4659,46 +7643,147 @@ void make_upper(std::string& str) {
   \return >0 if first string is lexicographically after the second string
   \return =0 if the two strings are equal
 
-  Strings must be valid UTF-8 strings.
+  Invalid encodings compare as REPLACEMENT_CHARACTER (0xfffd).
 */
-[[nodiscard]] auto icompare(std::string const& str1, std::string const& str2) -> int32_t {
-    assert(valid_str(str1) && valid_str(str2));
+[[nodiscard]] auto icompare(std::string_view str1, std::string_view str2) -> int32_t {
+    return icompare_n(str1, str2, std::string_view::npos);
+}
 
-    auto p1 = begin(str1);
-    auto p2 = begin(str2);
-    while (p1 < end(str1) && p2 < end(str2)) {
-        char32_t lc1;
-        char32_t lc2;
-        char32_t c1 = next(p1, end(str1));
-        char32_t c2 = next(p2, end(str2));
+/*!
+  Compare at most `n` characters of two strings in a case-insensitive way.
 
-        const char32_t* f = std::lower_bound(std::begin(u2l), std::end(u2l), c1);
-        if (f != std::end(u2l) && *f == c1) {
-            lc1 = lc[f - u2l];
-        }
-        else {
-            lc1 = c1;
-        }
-        f = std::lower_bound(std::begin(u2l), std::end(u2l), c2);
-        if (f != std::end(u2l) && *f == c2) {
-            lc2 = lc[f - u2l];
-        }
-        else {
-            lc2 = c2;
-        }
-        if ((lc1 != lc2)) {
-            return (lc1 < lc2) ? -1 : 1;
-        }
+  \param str1 first string
+  \param str2 second string
+  \param n    maximum number of characters to compare
+  \return <0, 0 or >0 like icompare()
+*/
+[[nodiscard]] auto icompare_n(std::string_view str1, std::string_view str2, size_t n) -> int32_t {
+    const char* p1 = str1.data();
+    const char* last1 = p1 + str1.size();
+    const char* p2 = str2.data();
+    const char* last2 = p2 + str2.size();
+    const int32_t result = icompare_chars(p1, last1, p2, last2, n);
+    if (result != 0 || n == 0) {
+        return result;
     }
-    if (p1 != end(str1)) {
+    if (p1 != last1) {
         return 1;
     }
-    if (p2 != end(str2)) {
+    if (p2 != last2) {
         return -1;
     }
     return 0;
 }
 
+/*!
+  Check in a case-insensitive way if a string begins with a prefix
+
+  \param str    string to check
+  \param prefix prefix to look for
+  \return `true` if `str` begins with `prefix`
+*/
+[[nodiscard]] auto istarts_with(std::string_view str, std::string_view prefix) -> bool {
+    const char* p1 = str.data();
+    const char* p2 = prefix.data();
+    const char* last2 = p2 + prefix.size();
+    size_t n = std::string_view::npos;
+    return icompare_chars(p1, p1 + str.size(), p2, last2, n) == 0 && p2 == last2;
+}
+
+/*!
+  Check in a case-insensitive way if a string ends with a suffix
+
+  \param str    string to check
+  \param suffix suffix to look for
+  \return `true` if `str` ends with `suffix`
+
+  Case mapping never changes the number of characters, so the suffix is
+  compared with the same number of characters at the end of `str`. In strings
+  with invalid encodings, characters are delimited by their lead bytes, like
+  in retreat().
+*/
+[[nodiscard]] auto iends_with(std::string_view str, std::string_view suffix) -> bool {
+    const size_t nchars = count_runes(suffix.data(), suffix.size());
+    const char* tail = str.data() + str.size();
+    if (retreat(tail, str.data(), nchars) != nchars) {
+        return false;
+    }
+    return icompare(std::string_view(tail, static_cast<size_t>(str.data() + str.size() - tail)), suffix) == 0;
+}
+
+/*!
+  \class ihash
+
+  Hash function object for unordered containers with case-insensitive UTF-8
+  keys. Use it together with iequal; strings that are equal for iequal have
+  the same hash:
+\code
+  std::unordered_map<std::string, int, utf8::ihash, utf8::iequal> counts;
+  counts["Straße"]++;
+  counts["STRAẞE"]++; // same entry
+  auto it = counts.find(std::string_view("strasse")); // no temporary string
+\endcode
+
+  The hash is computed over the lower case UTF-8 encoding of the string,
+  without building it: ASCII runs are lowered by ascii_case() directly into
+  a small buffer and other characters are lowered one by one. Invalid
+  encodings are hashed as REPLACEMENT_CHARACTER (0xfffd), like icompare()
+  compares them.
+*/
+
+/// Mix a word into a hash value
+static auto hash_mix(uint64_t h, uint64_t word) -> uint64_t {
+    h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
+
+/*!
+  Return hash value of a string
+  \param str UTF-8 string
+*/
+auto ihash::operator()(std::string_view str) const -> size_t {
+    uint64_t h = 0x243F6A8885A308D3ULL;
+    char buf[64];
+    size_t nbuf = 0;
+    size_t nbytes = 0;
+    const char* ptr = str.data();
+    const char* last = ptr + str.size();
+    while (ptr < last) {
+        // leave room for one non-ASCII character
+        const size_t room = sizeof(buf) - 4 - nbuf;
+        const size_t nascii = ascii_case(ptr, std::min(room, static_cast<size_t>(last - ptr)), buf + nbuf, false);
+        ptr += nascii;
+        nbuf += nascii;
+        if (ptr < last && (*ptr & 0x80) != 0) {
+            nbuf += static_cast<size_t>(detail::encode(lower_map.map(next(ptr, last)), buf + nbuf) - (buf + nbuf));
+        }
+
+        // consume whole words; less than 8 bytes remain
+        size_t i = 0;
+        for (; i + 8 <= nbuf; i += 8) {
+            uint64_t word;
+            memcpy(&word, buf + i, sizeof(word));
+            h = hash_mix(h, word);
+        }
+        nbytes += i;
+        memmove(buf, buf + i, nbuf - i);
+        nbuf -= i;
+    }
+
+    uint64_t word = 0;
+    memcpy(&word, buf, nbuf);
+    h = hash_mix(h, word);
+    h = hash_mix(h, nbytes + nbuf);
+
+    // final avalanche from MurmurHash3
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+}
+
 
 } // namespace utf8
 